@@ -0,0 +1,203 @@
+#include "Database.h"
+#include "Record.h"
+#include "Aggregate.h"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <limits>
+
+template <typename T>
+static double readAs(const char* field)
+{
+	T value;
+	memcpy(&value, field, sizeof(T));
+	return static_cast<double>(value);
+}
+// A group key: integers exactly, through their own type rather than double
+template <typename T>
+static std::string textAs(const char* field)
+{
+	T value;
+	memcpy(&value, field, sizeof(T));
+	return std::to_string(+value);
+}
+// Floating point keys with the digits that read back to the same value, so
+// that values std::to_string would round alike stay apart
+template <typename T>
+static std::string textAsReal(const char* field)
+{
+	T value;
+	memcpy(&value, field, sizeof(T));
+	if (value == 0)
+		value = 0;   // -0 and 0 are one group
+	char text[32];
+	snprintf(text, sizeof(text), "%.*g", std::numeric_limits<T>::max_digits10, static_cast<double>(value));
+	return text;
+}
+
+Aggregate::Aggregate(Record& rec, const std::vector<recKey*>& k) :
+	record(&rec),
+	keys(k),
+	bodySize(rec.GetDataSize() - sizeof(int) - REC_NAME_SIZE)
+{
+}
+// The field types that can be aggregated
+struct FieldType
+{
+	const std::type_info& type;
+	double (*read)(const char* field);
+	std::string (*text)(const char* field);
+	std::size_t size;
+	bool integral;
+};
+static const FieldType fieldTypes[] =
+{
+	{ typeid(bool), readAs<bool>, textAs<bool>, sizeof(bool), true },
+	{ typeid(char), readAs<char>, textAs<char>, sizeof(char), true },
+	{ typeid(signed char), readAs<signed char>, textAs<signed char>, sizeof(signed char), true },
+	{ typeid(unsigned char), readAs<unsigned char>, textAs<unsigned char>, sizeof(unsigned char), true },
+	{ typeid(signed short int), readAs<signed short int>, textAs<signed short int>, sizeof(signed short int), true },
+	{ typeid(unsigned short int), readAs<unsigned short int>, textAs<unsigned short int>, sizeof(unsigned short int), true },
+	{ typeid(signed int), readAs<signed int>, textAs<signed int>, sizeof(signed int), true },
+	{ typeid(unsigned int), readAs<unsigned int>, textAs<unsigned int>, sizeof(unsigned int), true },
+	{ typeid(signed long int), readAs<signed long int>, textAs<signed long int>, sizeof(signed long int), true },
+	{ typeid(unsigned long int), readAs<unsigned long int>, textAs<unsigned long int>, sizeof(unsigned long int), true },
+	{ typeid(signed long long int), readAs<signed long long int>, textAs<signed long long int>, sizeof(signed long long int), true },
+	{ typeid(unsigned long long int), readAs<unsigned long long int>, textAs<unsigned long long int>, sizeof(unsigned long long int), true },
+	{ typeid(float), readAs<float>, textAsReal<float>, sizeof(float), false },
+	{ typeid(double), readAs<double>, textAsReal<double>, sizeof(double), false },
+};
+
+Aggregate::ReadValue Aggregate::Reader(const std::type_info& type, std::size_t& size, bool& integral, ReadText* text)
+{
+	for (const FieldType& f : fieldTypes)
+	{
+		if (f.type == type)
+		{
+			size = f.size;
+			integral = f.integral;
+			if (text != nullptr)
+				*text = f.text;
+			return f.read;
+		}
+	}
+	return nullptr;
+}
+Aggregate& Aggregate::Over(std::size_t offset, const std::type_info& type)
+{
+	std::size_t size;
+	bool integral;
+	ReadValue read = Reader(type, size, integral);
+	if (read == nullptr)
+	{
+		std::cout << "'" << type.name() << "' is not supported." << std::endl;
+		valid = false;
+		return *this;
+	}
+	if (offset + size > bodySize)
+	{
+		std::cout << "Field is outside the record." << std::endl;
+		valid = false;
+		return *this;
+	}
+	over = true;
+	valueOffset = offset;
+	readValue = read;
+	return *this;
+}
+Aggregate& Aggregate::GroupBy(std::size_t offset, std::size_t size, const std::type_info& type)
+{
+	if (size == 0 || offset + size > bodySize)
+	{
+		std::cout << "Field is outside the record." << std::endl;
+		valid = false;
+		return *this;
+	}
+	std::size_t typeSize;
+	ReadText text = nullptr;
+	ReadValue read = Reader(type, typeSize, groupIntegral, &text);
+	if (read != nullptr && typeSize > size)
+	{
+		std::cout << "Field is outside the record." << std::endl;
+		valid = false;
+		return *this;
+	}
+	grouped = true;
+	groupOffset = offset;
+	groupSize = size;
+	readGroup = read != nullptr ? text : nullptr;
+	return *this;
+}
+const Aggregate::Totals& Aggregate::Total(void) const
+{
+	return total;
+}
+const Aggregate::GroupMap& Aggregate::Groups(void) const
+{
+	return groups;
+}
+bool Aggregate::GroupOrder::operator()(const std::string& a, const std::string& b) const
+{
+	if (kind == Real)
+	{
+		double x = strtod(a.c_str(), nullptr);
+		double y = strtod(b.c_str(), nullptr);
+		if (std::isnan(x) || std::isnan(y))
+			return !std::isnan(x);   // nan last
+		return x < y;
+	}
+	if (kind == Text)
+		return a < b;
+	// Integers without leading zeros: by sign, then length, then digits
+	bool negA = !a.empty() && a[0] == '-';
+	bool negB = !b.empty() && b[0] == '-';
+	if (negA != negB)
+		return negA;
+	if (a.size() != b.size())
+		return negA ? a.size() > b.size() : a.size() < b.size();
+	return negA ? b < a : a < b;
+}
+void Aggregate::Add(Totals& totals, bool hasValue, double value)
+{
+	totals.count++;
+	if (!hasValue)
+		return;
+	totals.sum += value;
+	if (totals.count == 1 || value < totals.min)
+		totals.min = value;
+	if (totals.count == 1 || value > totals.max)
+		totals.max = value;
+}
+bool Aggregate::Run(void)
+{
+	total = Totals();
+	GroupOrder order;
+	if (readGroup != nullptr)
+		order.kind = groupIntegral ? GroupOrder::Integer : GroupOrder::Real;
+	groups = GroupMap(order);
+	if (!valid)
+		return false;
+
+	Cursor cursor(*record, keys);
+	RecordView view;
+	std::string group;
+	OpResult ret;
+	while ((ret = cursor.Next(view)) == OpResult::True)
+	{
+		const char* body = view.data + sizeof(int) + REC_NAME_SIZE;
+		double value = over ? readValue(body + valueOffset) : 0;
+		Add(total, over, value);
+		if (!grouped)
+			continue;
+
+		const char* field = body + groupOffset;
+		if (readGroup == nullptr)
+			group.assign(field, strnlen(field, groupSize));
+		else
+			group = readGroup(field);
+		Add(groups[group], over, value);
+	}
+	return ret != OpResult::Null;
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include <map>
+#include <string>
+#include <typeinfo>
+#include <vector>
+#include "Cursor.h"
+
+// Count, sum, min, max and average of a field over the records of one
+// type that match a list of recKeys, optionally per value of another
+// field. The records are read in place by a cursor; no Record is built.
+//
+//	Person p;
+//	Aggregate a(p, { &k1 });
+//	a.Over(8, typeid(int)).GroupBy(12, 16, typeid(char[16]));
+//	if (a.Run())
+//		for (const auto& g : a.Groups())
+//			std::cout << g.first << " " << g.second.count << " " << g.second.Avg() << std::endl;
+//
+// Fields are located like a recKey: offset from the byte after RecName,
+// and their type. Integer, char, bool, float and double fields can be
+// aggregated; sums are kept as double. Groups of a numeric field are keyed
+// by the exact value as text and ordered by value.
+class Aggregate
+{
+public:
+	struct Totals
+	{
+		long long count = 0;
+		double sum = 0;
+		double min = 0;
+		double max = 0;
+		double Avg(void) const { return count == 0 ? 0 : sum / count; }
+	};
+	// Order of the group keys: by value for numeric fields, else by text
+	struct GroupOrder
+	{
+		enum Kind { Text, Integer, Real } kind = Text;
+		bool operator()(const std::string& a, const std::string& b) const;
+	};
+	typedef std::map<std::string, Totals, GroupOrder> GroupMap;
+
+	Aggregate(Record& record, const std::vector<recKey*>& keys);
+
+	// The field summed; without one only the counts are computed
+	Aggregate& Over(std::size_t offset, const std::type_info& type);
+	// Groups by a field: numeric fields by value, anything else (char[])
+	// by its text up to the first null
+	Aggregate& GroupBy(std::size_t offset, std::size_t size, const std::type_info& type);
+
+	// Scans the matches; false on error
+	bool Run(void);
+	const Totals& Total(void) const;
+	// Totals per group value, when GroupBy was set
+	const GroupMap& Groups(void) const;
+
+private:
+	typedef double (*ReadValue)(const char* field);
+	typedef std::string (*ReadText)(const char* field);
+	static ReadValue Reader(const std::type_info& type, std::size_t& size, bool& integral, ReadText* text = nullptr);
+	static void Add(Totals& totals, bool hasValue, double value);
+
+	Record* record;
+	std::vector<recKey*> keys;
+	std::size_t bodySize;
+
+	bool over = false;
+	std::size_t valueOffset = 0;
+	ReadValue readValue = nullptr;
+
+	bool grouped = false;
+	std::size_t groupOffset = 0;
+	std::size_t groupSize = 0;
+	ReadText readGroup = nullptr;    // nullptr: group by text
+	bool groupIntegral = false;
+
+	bool valid = true;
+	Totals total;
+	GroupMap groups;
+};
@@ -0,0 +1,304 @@
+#include "AsyncIO.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define SYSCPPCP_IO_URING 1
+#endif
+
+AsyncIO::AsyncIO(unsigned int queueDepth) :
+	depth(std::max(1u, queueDepth))
+{
+	SetupRing();
+}
+AsyncIO::~AsyncIO()
+{
+	Drain();
+	CloseRing();
+}
+bool AsyncIO::UsesIoUring(void) const
+{
+	return ringFd != -1;
+}
+std::future<bool> AsyncIO::QueueWrite(std::function<bool()> op)
+{
+	std::call_once(writerStarted, [this]() { writer.Start(1); });
+	auto task = std::make_shared<std::packaged_task<bool()>>(op);
+	std::future<bool> result = task->get_future();
+	writer.Push([task]() { (*task)(); });
+	return result;
+}
+void AsyncIO::Drain(void)
+{
+	writer.Wait();
+}
+void AsyncIO::ReadBatch(int fd, std::vector<Request>& requests)
+{
+	for (Request& r : requests)
+		r.done = 0;
+	if (requests.empty())
+		return;
+	if (ringFd != -1)
+		RingRead(fd, requests);
+	else
+		PoolRead(fd, requests);
+}
+std::size_t AsyncIO::ReadFully(int fd, Request& request)
+{
+	while (request.done < request.size)
+	{
+		ssize_t got = pread(fd, request.dest + request.done, request.size - request.done,
+			request.offset + request.done);
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got <= 0)
+			break;
+		request.done += static_cast<std::size_t>(got);
+	}
+	return request.done;
+}
+// Fallback: the requests are spread over depth threads
+void AsyncIO::PoolRead(int fd, std::vector<Request>& requests)
+{
+	if (requests.size() == 1)
+	{
+		ReadFully(fd, requests[0]);
+		return;
+	}
+	std::call_once(readersStarted, [this]() { readers.Start(std::min(depth, 16u)); });
+	std::atomic<std::size_t> next{ 0 };
+	std::size_t helpers = std::min<std::size_t>(requests.size() - 1, std::min(depth, 16u));
+	std::mutex doneLock;
+	std::condition_variable done;
+	auto work = [&]()
+	{
+		for (std::size_t i = next++; i < requests.size(); i = next++)
+			ReadFully(fd, requests[i]);
+	};
+	for (std::size_t t = 0; t < helpers; t++)
+	{
+		readers.Push([&]()
+		{
+			work();
+			std::lock_guard<std::mutex> guard(doneLock);
+			if (--helpers == 0)
+				done.notify_all();
+		});
+	}
+	work();
+	// The helpers use the locals of this frame until they return
+	std::unique_lock<std::mutex> guard(doneLock);
+	done.wait(guard, [&]() { return helpers == 0; });
+}
+
+#ifdef SYSCPPCP_IO_URING
+bool AsyncIO::SetupRing(void)
+{
+	io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	int fd = static_cast<int>(syscall(__NR_io_uring_setup, depth, &params));
+	if (fd < 0)
+		return false;   // old kernel, or blocked by a seccomp policy
+
+	sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+	bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+	if (single)
+		sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+	sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (sqRing == MAP_FAILED)
+	{
+		sqRing = nullptr;
+		::close(fd);
+		return false;
+	}
+	if (single)
+		cqRing = sqRing;
+	else
+	{
+		cqRing = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if (cqRing == MAP_FAILED)
+		{
+			cqRing = nullptr;
+			ringFd = fd;
+			CloseRing();
+			return false;
+		}
+	}
+	sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+	sqes = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED)
+	{
+		sqes = nullptr;
+		ringFd = fd;
+		CloseRing();
+		return false;
+	}
+	char* sq = static_cast<char*>(sqRing);
+	char* cq = static_cast<char*>(cqRing);
+	sqHead = reinterpret_cast<unsigned int*>(sq + params.sq_off.head);
+	sqTail = reinterpret_cast<unsigned int*>(sq + params.sq_off.tail);
+	sqMask = reinterpret_cast<unsigned int*>(sq + params.sq_off.ring_mask);
+	sqArray = reinterpret_cast<unsigned int*>(sq + params.sq_off.array);
+	cqHead = reinterpret_cast<unsigned int*>(cq + params.cq_off.head);
+	cqTail = reinterpret_cast<unsigned int*>(cq + params.cq_off.tail);
+	cqMask = reinterpret_cast<unsigned int*>(cq + params.cq_off.ring_mask);
+	cqes = cq + params.cq_off.cqes;
+	sqEntries = params.sq_entries;
+	ringFd = fd;
+	return true;
+}
+void AsyncIO::CloseRing(void)
+{
+	if (sqes != nullptr)
+		munmap(sqes, sqesSize);
+	if (cqRing != nullptr && cqRing != sqRing)
+		munmap(cqRing, cqRingSize);
+	if (sqRing != nullptr)
+		munmap(sqRing, sqRingSize);
+	sqes = cqRing = sqRing = nullptr;
+	if (ringFd != -1)
+		::close(ringFd);
+	ringFd = -1;
+}
+// Keeps up to sqEntries reads in flight until all have completed. A read
+// the ring could not finish is completed with pread.
+void AsyncIO::RingRead(int fd, std::vector<Request>& requests)
+{
+	std::lock_guard<std::mutex> guard(ringLock);
+	std::size_t next = 0;
+	std::size_t inFlight = 0;
+	io_uring_sqe* sqeArray = static_cast<io_uring_sqe*>(sqes);
+	io_uring_cqe* cqeArray = static_cast<io_uring_cqe*>(cqes);
+
+	bool failed = false;
+
+	while ((!failed && next < requests.size()) || inFlight > 0)
+	{
+		unsigned int tail = *sqTail;
+		while (!failed && next < requests.size() && inFlight < sqEntries)
+		{
+			Request& r = requests[next];
+			unsigned int index = tail & *sqMask;
+			io_uring_sqe* sqe = &sqeArray[index];
+			memset(sqe, 0, sizeof(*sqe));
+			sqe->opcode = IORING_OP_READ;
+			sqe->fd = fd;
+			sqe->off = static_cast<unsigned long long>(r.offset);
+			sqe->addr = reinterpret_cast<unsigned long long>(r.dest);
+			sqe->len = static_cast<unsigned int>(r.size);
+			sqe->user_data = next;
+			sqArray[index] = index;
+			tail++;
+			next++;
+			inFlight++;
+		}
+		__atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+
+		if (!failed)
+		{
+			// Entries the kernel has not taken yet, including ones left
+			// over from an interrupted call
+			unsigned int toSubmit = tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+			int entered = static_cast<int>(syscall(__NR_io_uring_enter, ringFd, toSubmit, 1,
+				IORING_ENTER_GETEVENTS, nullptr, 0));
+			if (entered < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+			{
+				// The ring failed: stop submitting, and wait for the reads
+				// the kernel already took, since they write to our buffers
+				failed = true;
+				inFlight -= std::min<std::size_t>(inFlight, tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE));
+			}
+		}
+		else
+			usleep(100);
+
+		unsigned int head = *cqHead;
+		while (head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE))
+		{
+			io_uring_cqe* cqe = &cqeArray[head & *cqMask];
+			Request& r = requests[static_cast<std::size_t>(cqe->user_data)];
+			if (cqe->res >= 0)
+				r.done = static_cast<std::size_t>(cqe->res);
+			head++;
+			inFlight--;
+		}
+		__atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+	}
+	// Short reads, errors (an opcode the kernel lacks) and whatever a
+	// failed ring did not run
+	for (Request& r : requests)
+	{
+		if (r.done < r.size)
+			ReadFully(fd, r);
+	}
+	if (failed)
+		CloseRing();
+}
+#else
+bool AsyncIO::SetupRing(void)
+{
+	return false;
+}
+void AsyncIO::CloseRing(void)
+{
+}
+void AsyncIO::RingRead(int fd, std::vector<Request>& requests)
+{
+	PoolRead(fd, requests);
+}
+#endif
+
+AsyncIO::WorkQueue::~WorkQueue()
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (std::thread& t : threads)
+		t.join();
+}
+void AsyncIO::WorkQueue::Start(unsigned int count)
+{
+	for (unsigned int i = 0; i < count; i++)
+		threads.emplace_back([this]() { Run(); });
+}
+void AsyncIO::WorkQueue::Push(std::function<void()> task)
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		tasks.push_back(std::move(task));
+	}
+	wake.notify_one();
+}
+void AsyncIO::WorkQueue::Wait(void)
+{
+	std::unique_lock<std::mutex> guard(lock);
+	idle.wait(guard, [this]() { return tasks.empty() && running == 0; });
+}
+void AsyncIO::WorkQueue::Run(void)
+{
+	std::unique_lock<std::mutex> guard(lock);
+	while (true)
+	{
+		wake.wait(guard, [this]() { return stopping || !tasks.empty(); });
+		if (tasks.empty())
+			return;   // stopping
+		std::function<void()> task = std::move(tasks.front());
+		tasks.pop_front();
+		running++;
+		guard.unlock();
+		task();
+		guard.lock();
+		running--;
+		if (tasks.empty() && running == 0)
+			idle.notify_all();
+	}
+}
@@ -0,0 +1,94 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <ios>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Asynchronous I/O for one database. Batches of positional reads are
+// submitted together so that many are in flight at once: through io_uring
+// when the kernel allows it, otherwise on a pool of threads calling pread.
+//
+// Writes are not asynchronous I/O: QueueWrite is a background queue. Its
+// one thread runs each queued operation (Record::Insert, Update, Delete)
+// through the same synchronous path as a direct call, with its locks, log
+// records and index updates, in the order they were queued. It moves the
+// write off the caller's thread; it does not overlap the writes.
+class AsyncIO
+{
+public:
+	struct Request
+	{
+		std::streamoff offset;
+		char* dest;
+		std::size_t size;
+		std::size_t done;    // bytes read, set by ReadBatch
+	};
+
+	explicit AsyncIO(unsigned int depth = 64);
+	~AsyncIO();
+	AsyncIO(const AsyncIO&) = delete;
+	AsyncIO& operator=(const AsyncIO&) = delete;
+
+	// Reads every request from fd and returns when all have completed
+	void ReadBatch(int fd, std::vector<Request>& requests);
+	// Runs op on the writer thread, after the ops queued before it. op does
+	// its own I/O, synchronously.
+	std::future<bool> QueueWrite(std::function<bool()> op);
+	// Waits for the queued writes
+	void Drain(void);
+	bool UsesIoUring(void) const;
+
+private:
+	// Threads taking tasks from a queue
+	class WorkQueue
+	{
+	public:
+		~WorkQueue();
+		void Start(unsigned int threads);
+		void Push(std::function<void()> task);
+		void Wait(void);
+	private:
+		void Run(void);
+		std::vector<std::thread> threads;
+		std::deque<std::function<void()>> tasks;
+		unsigned int running = 0;
+		bool stopping = false;
+		std::mutex lock;
+		std::condition_variable wake;
+		std::condition_variable idle;
+	};
+
+	bool SetupRing(void);
+	void CloseRing(void);
+	void RingRead(int fd, std::vector<Request>& requests);
+	void PoolRead(int fd, std::vector<Request>& requests);
+	static std::size_t ReadFully(int fd, Request& request);
+
+	unsigned int depth;
+	std::mutex ringLock;
+	int ringFd = -1;
+	void* sqRing = nullptr;
+	std::size_t sqRingSize = 0;
+	void* cqRing = nullptr;
+	std::size_t cqRingSize = 0;
+	void* sqes = nullptr;
+	std::size_t sqesSize = 0;
+	unsigned int* sqHead = nullptr;
+	unsigned int* sqTail = nullptr;
+	unsigned int* sqMask = nullptr;
+	unsigned int* sqArray = nullptr;
+	unsigned int* cqHead = nullptr;
+	unsigned int* cqTail = nullptr;
+	unsigned int* cqMask = nullptr;
+	void* cqes = nullptr;
+	unsigned int sqEntries = 0;
+
+	std::once_flag readersStarted;
+	WorkQueue readers;
+	std::once_flag writerStarted;
+	WorkQueue writer;
+};
@@ -0,0 +1,272 @@
+#include "BufferPool.h"
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+static const std::size_t defaultBudget = 32 * 1024 * 1024;
+
+BufferPool::BufferPool(std::function<std::size_t(std::streamoff, char*, std::size_t)> loader,
+	std::function<void(std::vector<AsyncIO::Request>&)> batchLoader) :
+	load(loader),
+	loadBatch(batchLoader),
+	capacity(defaultBudget / PageSize)
+{
+}
+void BufferPool::SetBudget(std::size_t bytes)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	capacity = std::max<std::size_t>(1, bytes / PageSize);
+	// Give back unpinned pages over the budget
+	while (table.size() > capacity && !lru.empty())
+	{
+		int frame = lru.back();
+		lru.pop_back();
+		table.erase(frames[frame].page);
+		frames[frame].page = -1;
+		frames[frame].data.clear();
+		frames[frame].data.shrink_to_fit();
+		freeFrames.push_back(frame);
+	}
+}
+std::size_t BufferPool::Budget(void) const
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return capacity * PageSize;
+}
+// A free frame, a new one while under budget, or the least recently used
+// page; -1 if every page is pinned or loading
+int BufferPool::TakeFrame(void)
+{
+	if (table.size() < capacity)
+	{
+		if (!freeFrames.empty())
+		{
+			int frame = freeFrames.back();
+			freeFrames.pop_back();
+			return frame;
+		}
+		frames.emplace_back();
+		return static_cast<int>(frames.size() - 1);
+	}
+	if (lru.empty())
+		return -1;
+	int frame = lru.back();
+	lru.pop_back();
+	table.erase(frames[frame].page);
+	frames[frame].page = -1;
+	return frame;
+}
+bool BufferPool::PinPage(std::streamoff offset, Pin& pin)
+{
+	std::streamoff page = offset - offset % static_cast<std::streamoff>(PageSize);
+	std::unique_lock<std::mutex> guard(lock);
+	int frame;
+	auto it = table.find(page);
+	while (it != table.end() && frames[it->second].loading)
+	{
+		loaded.wait(guard);   // read by another thread; it may also fail
+		it = table.find(page);
+	}
+	if (it != table.end())
+	{
+		hits++;
+		frame = it->second;
+		if (frames[frame].pins++ == 0)
+			lru.erase(frames[frame].lru);
+	}
+	else
+	{
+		misses++;
+		frame = TakeFrame();
+		if (frame == -1)
+			return false;
+		// In the table, pinned and loading while the file is read
+		Frame& f = frames[frame];
+		f.data.resize(PageSize);
+		f.page = page;
+		f.pins = 1;
+		f.loading = true;
+		table[page] = frame;
+		char* dest = f.data.data();   // frames may grow; the buffer does not move
+		unsigned long long generation = f.generation;
+		guard.unlock();
+		std::size_t size = load(page, dest, PageSize);
+		guard.lock();
+		if (!Loaded(frame, generation, page, size))
+			return false;
+	}
+	Frame& f = frames[frame];
+	pin.frame = frame;
+	pin.generation = f.generation;
+	pin.start = page;
+	pin.data = f.data.data();
+	pin.size = f.size;
+	return true;
+}
+// Publishes a page read outside the lock, or gives its frame back when the
+// read failed or the page was invalidated or cleared in the meantime.
+// Called with the lock held.
+bool BufferPool::Loaded(int frame, unsigned long long generation, std::streamoff page, std::size_t size)
+{
+	Frame& f = frames[frame];
+	f.loading = false;
+	loaded.notify_all();
+	if (f.generation != generation)
+	{
+		freeFrames.push_back(frame);   // Clear left it out
+		return false;
+	}
+	f.size = size;
+	if (f.page == page && size != 0)
+		return true;
+	if (f.page == page)
+		table.erase(page);   // past the end of the file
+	f.page = -1;
+	f.pins = 0;
+	freeFrames.push_back(frame);
+	return false;
+}
+void BufferPool::Release(int frame)
+{
+	Frame& f = frames[frame];
+	if (f.page == -1)
+		freeFrames.push_back(frame);   // invalidated while pinned
+	else
+	{
+		lru.push_front(frame);
+		f.lru = lru.begin();
+	}
+}
+void BufferPool::Unpin(Pin& pin)
+{
+	if (pin.frame == -1)
+		return;
+	std::lock_guard<std::mutex> guard(lock);
+	Frame& f = frames[pin.frame];
+	// A Clear since the pin was taken already released it
+	if (f.generation == pin.generation && --f.pins == 0)
+		Release(pin.frame);
+	pin.frame = -1;
+	pin.data = nullptr;
+	pin.size = 0;
+}
+std::size_t BufferPool::Prefetch(const std::vector<std::streamoff>& offsets)
+{
+	std::unique_lock<std::mutex> guard(lock);
+	std::vector<AsyncIO::Request> requests;
+	std::vector<int> taken;
+	std::vector<unsigned long long> generations;
+	for (std::streamoff offset : offsets)
+	{
+		std::streamoff page = offset - offset % static_cast<std::streamoff>(PageSize);
+		if (table.count(page) != 0 || std::any_of(requests.begin(), requests.end(),
+			[page](const AsyncIO::Request& r) { return r.offset == page; }))
+			continue;
+		// Never evict more than half the budget for pages that may not be read
+		if (taken.size() >= std::max<std::size_t>(1, capacity / 2))
+			break;
+		int frame = TakeFrame();
+		if (frame == -1)
+			break;
+		Frame& f = frames[frame];
+		f.data.resize(PageSize);
+		f.page = page;
+		f.pins = 0;
+		f.loading = true;
+		table[page] = frame;
+		requests.push_back({ page, f.data.data(), PageSize, 0 });
+		taken.push_back(frame);
+		generations.push_back(f.generation);
+	}
+	if (requests.empty())
+		return 0;
+	guard.unlock();
+	loadBatch(requests);
+	guard.lock();
+
+	std::size_t count = 0;
+	for (std::size_t i = 0; i < requests.size(); i++)
+	{
+		if (!Loaded(taken[i], generations[i], requests[i].offset, requests[i].done))
+			continue;
+		// Behind the pages in use, so that an unread prefetch goes first.
+		// Threads waiting for it only wake once the lock is released.
+		lru.push_back(taken[i]);
+		frames[taken[i]].lru = std::prev(lru.end());
+		count++;
+	}
+	misses += count;
+	return count;
+}
+bool BufferPool::IsCached(std::streamoff offset) const
+{
+	std::streamoff page = offset - offset % static_cast<std::streamoff>(PageSize);
+	std::lock_guard<std::mutex> guard(lock);
+	return table.count(page) != 0;
+}
+std::size_t BufferPool::Read(std::streamoff offset, char* dest, std::size_t n)
+{
+	std::size_t done = 0;
+	while (done < n)
+	{
+		Pin pin;
+		std::streamoff at = offset + done;
+		// Past the end of the file, or every page pinned: read around the cache
+		if (!PinPage(at, pin))
+			return done + load(at, dest + done, n - done);
+		std::size_t from = static_cast<std::size_t>(at - pin.start);
+		std::size_t count = from < pin.size ? std::min(n - done, pin.size - from) : 0;
+		memcpy(dest + done, pin.data + from, count);
+		done += count;
+		bool partial = pin.size < PageSize;
+		Unpin(pin);
+		if (count == 0 || partial)
+			break;   // end of the file
+	}
+	return done;
+}
+void BufferPool::Invalidate(std::streamoff offset, std::size_t n)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	std::streamoff page = offset - offset % static_cast<std::streamoff>(PageSize);
+	for (; page < offset + static_cast<std::streamoff>(n); page += PageSize)
+	{
+		auto it = table.find(page);
+		if (it == table.end())
+			continue;
+		int frame = it->second;
+		table.erase(it);
+		frames[frame].page = -1;
+		// A page being loaded is given back by its loader
+		if (frames[frame].pins == 0 && !frames[frame].loading)
+		{
+			lru.erase(frames[frame].lru);
+			freeFrames.push_back(frame);
+		}
+	}
+}
+void BufferPool::Clear(void)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	table.clear();
+	lru.clear();
+	freeFrames.clear();
+	for (std::size_t i = 0; i < frames.size(); i++)
+	{
+		frames[i].page = -1;
+		frames[i].pins = 0;
+		frames[i].generation++;
+		if (!frames[i].loading)
+			freeFrames.push_back(static_cast<int>(i));   // else by its loader
+	}
+}
+unsigned long long BufferPool::Hits(void) const
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return hits;
+}
+unsigned long long BufferPool::Misses(void) const
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return misses;
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include <condition_variable>
+#include <functional>
+#include <ios>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "AsyncIO.h"
+
+// Fixed budget cache of data file pages, used for reads when the file is not
+// memory mapped. Pages are loaded whole through the load function and evicted
+// least recently used first; a pinned page is never evicted or reused. The
+// file is read without holding the lock: a page being loaded is in the table
+// already, and a thread that wants it waits for the load.
+class BufferPool
+{
+public:
+	static const std::size_t PageSize = 16 * 1024;
+
+	// A pinned page: data holds size bytes of the file from start
+	struct Pin
+	{
+		int frame = -1;
+		unsigned long long generation = 0;
+		std::streamoff start = 0;
+		const char* data = nullptr;
+		std::size_t size = 0;
+	};
+
+	// load(offset, dest, n) reads up to n bytes of the file and returns the
+	// count; loadBatch reads several ranges at once (see AsyncIO::ReadBatch)
+	BufferPool(std::function<std::size_t(std::streamoff, char*, std::size_t)> load,
+		std::function<void(std::vector<AsyncIO::Request>&)> loadBatch);
+
+	// Memory budget in bytes; at least one page
+	void SetBudget(std::size_t bytes);
+	std::size_t Budget(void) const;
+
+	// Pins the page holding offset. False past the end of the file, or when
+	// every page of the budget is pinned.
+	bool PinPage(std::streamoff offset, Pin& pin);
+	void Unpin(Pin& pin);
+	// Loads the pages holding offsets that are not cached, with one batch of
+	// reads, without pinning them. Returns the number loaded.
+	std::size_t Prefetch(const std::vector<std::streamoff>& offsets);
+	bool IsCached(std::streamoff offset) const;
+
+	// Copies up to n bytes at offset to dest through the cache
+	std::size_t Read(std::streamoff offset, char* dest, std::size_t n);
+
+	// Drops the pages overlapping a range about to be written, or all pages
+	void Invalidate(std::streamoff offset, std::size_t n);
+	void Clear(void);
+
+	unsigned long long Hits(void) const;
+	unsigned long long Misses(void) const;
+
+private:
+	struct Frame
+	{
+		std::vector<char> data;
+		std::streamoff page = -1;     // file offset of the page; -1: not in the table
+		std::size_t size = 0;         // bytes loaded (less at the end of the file)
+		int pins = 0;
+		bool loading = false;         // being read, outside the lock
+		unsigned long long generation = 0;
+		std::list<int>::iterator lru;
+	};
+	int TakeFrame(void);
+	bool Loaded(int frame, unsigned long long generation, std::streamoff page, std::size_t size);
+	void Release(int frame);
+
+	std::function<std::size_t(std::streamoff, char*, std::size_t)> load;
+	std::function<void(std::vector<AsyncIO::Request>&)> loadBatch;
+	std::size_t capacity;
+	std::vector<Frame> frames;
+	std::vector<int> freeFrames;
+	std::list<int> lru;                              // unpinned pages, most recent first
+	std::unordered_map<std::streamoff, int> table;   // page offset -> frame
+	unsigned long long hits = 0;
+	unsigned long long misses = 0;
+	mutable std::mutex lock;
+	std::condition_variable loaded;   // a load finished
+};
@@ -0,0 +1,431 @@
+#include "Database.h"
+#include "Record.h"
+#include "Columnar.h"
+#include "Storage.h"
+#include <algorithm>
+#include <iostream>
+
+#pragma pack(push, 1)  // Aligns members on 1-byte boundaries
+// First bytes of a snapshot file. The COLUMNENTRY of each column follows,
+// then the ZONEENTRY of each block and column (block by block), then the
+// data of each column.
+struct COLHEADER
+{
+	char Magic[8];
+	long long int Version;
+	char RecName[REC_NAME_SIZE];
+	long long int Rows;
+	long long int Columns;
+	long long int BlockRows;
+};
+struct COLUMNENTRY
+{
+	long long int Offset;   // of the field, like a recKey
+	long long int Size;
+	long long int Kind;     // FieldKind of the min and max; -1 if not kept
+	long long int Start;    // of the column data in the file
+};
+struct ZONEENTRY
+{
+	long long int Min;
+	long long int Max;
+};
+#pragma pack(pop)  // Restores the previous packing alignment
+
+static const char columnMagic[8] = { 'S', 'Y', 'S', 'P', 'C', 'O', 'L', 'S' };
+static const long long int columnVersion = 1;
+// FilterField may read 3 bytes past a column of 1 or 2 byte fields
+static const std::size_t columnPadding = 3;
+
+const std::size_t ColumnSnapshot::BlockRows;
+
+std::string ColumnSnapshot::FileName(Database& db, const std::string& recName)
+{
+	return db.GetDatabaseName() + "." + recName + ".col";
+}
+bool ColumnSnapshot::Write(Database& db, const std::string& recName, const std::vector<recKey*>& fields)
+{
+	if (recName.empty() || recName.size() >= REC_NAME_SIZE)
+	{
+		std::cout << "Record name is invalid." << std::endl;
+		return false;
+	}
+	struct Field
+	{
+		std::size_t offset;
+		std::size_t size;
+		bool zoned;
+		FieldKind kind;
+		std::vector<char> data;
+		std::vector<SeekPlan::Zone> zones;
+	};
+	std::vector<Field> out;
+	auto exportField = [&out](std::size_t offset, std::size_t size, bool zoned, FieldKind kind)
+	{
+		Field f{};
+		f.offset = offset;
+		f.size = size;
+		f.zoned = zoned;
+		f.kind = kind;
+		out.push_back(std::move(f));
+	};
+	exportField(0, sizeof(long long), true, FieldKind::Int64);
+	for (recKey* k : fields)
+	{
+		if (k == nullptr || k->sz == 0)
+		{
+			std::cout << "Field is outside the record." << std::endl;
+			return false;
+		}
+		bool exported = false;
+		for (const Field& f : out)
+			exported = exported || (f.offset == k->offset && f.size == k->sz);
+		if (exported)
+			continue;
+		FieldKind kind;
+		bool zoned = SeekPlan::KindOf(k->typeInfo, kind) && FieldSize(kind) == k->sz;
+		exportField(k->offset, k->sz, zoned, zoned ? kind : FieldKind::Int64);
+	}
+
+	// The records as they are now; writes wait until they are copied
+	Storage& storage = Storage::Get(&db);
+	const std::size_t header = sizeof(int) + REC_NAME_SIZE;
+	long long int count = 0;
+	{
+		Storage::Access access(storage, false);
+		std::streamoff offset = 0;
+		int recSz;
+		while (storage.NextOfType(recName.c_str(), offset))
+		{
+			const char* head = storage.View(offset, header);
+			if (head == nullptr)
+				break;
+			memcpy(&recSz, head, sizeof(recSz));
+			if (recSz < static_cast<int>(header))
+				break;
+			if (strncmp(head + sizeof(int), recName.c_str(), REC_NAME_SIZE) != 0)
+			{
+				offset += recSz;
+				continue;
+			}
+			const char* body = storage.View(offset + header, recSz - header);
+			if (body == nullptr)
+				break;
+			for (Field& f : out)
+			{
+				if (f.offset + f.size > recSz - header)
+				{
+					std::cout << "Field is outside the record." << std::endl;
+					return false;
+				}
+				f.data.insert(f.data.end(), body + f.offset, body + f.offset + f.size);
+				if (count % BlockRows == 0)
+				{
+					f.zones.emplace_back();
+					f.zones.back().kind = f.kind;
+				}
+				if (f.zoned)
+					f.zones.back().Add(body + f.offset);
+			}
+			count++;
+			offset += recSz;
+		}
+	}
+
+	std::string fileName = FileName(db, recName);
+	std::ofstream col(fileName, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!col)
+	{
+		std::cerr << "Error: could not write column snapshot " << fileName << std::endl;
+		return false;
+	}
+	const long long int blocks = (count + BlockRows - 1) / BlockRows;
+	COLHEADER head;
+	memcpy(head.Magic, columnMagic, sizeof(columnMagic));
+	head.Version = columnVersion;
+	memset(head.RecName, 0, REC_NAME_SIZE);
+	strncpy(head.RecName, recName.c_str(), REC_NAME_SIZE - 1);
+	head.Rows = count;
+	head.Columns = out.size();
+	head.BlockRows = BlockRows;
+	col.write((char*)(&head), sizeof(COLHEADER));
+
+	COLUMNENTRY column;
+	std::streamoff start = sizeof(COLHEADER) + out.size() * sizeof(COLUMNENTRY) + blocks * out.size() * sizeof(ZONEENTRY);
+	for (const Field& f : out)
+	{
+		column.Offset = f.offset;
+		column.Size = f.size;
+		column.Kind = f.zoned ? static_cast<long long int>(f.kind) : -1;
+		column.Start = start;
+		col.write((char*)(&column), sizeof(COLUMNENTRY));
+		start += f.data.size();
+	}
+	ZONEENTRY zone;
+	for (long long int b = 0; b < blocks; b++)
+	{
+		for (const Field& f : out)
+		{
+			zone.Min = f.zones[b].min;
+			zone.Max = f.zones[b].max;
+			col.write((char*)(&zone), sizeof(ZONEENTRY));
+		}
+	}
+	for (const Field& f : out)
+		col.write(f.data.data(), f.data.size());
+	col.flush();
+	if (!col)
+	{
+		std::cerr << "Error: could not write column snapshot " << fileName << std::endl;
+		return false;
+	}
+	return true;
+}
+
+ColumnScan::ColumnScan(Record& record, const std::vector<recKey*>& keys)
+{
+	valid = Open(record);
+	if (!valid)
+		return;
+	plan.Compile(keys, [&record](std::string name) { return record.GetEnumValue(name); });
+	for (recKey* k : keys)
+	{
+		int c = Find(k->offset, k->sz);
+		if (c == -1)
+		{
+			std::cout << "Field is not in the column snapshot." << std::endl;
+			valid = false;
+			return;
+		}
+		keyColumns.push_back(c);
+	}
+}
+bool ColumnScan::Open(Record& record)
+{
+	Database* db = record.GetDatabase();
+	if (db == nullptr || !db->IsOpen())
+	{
+		std::cout << "Database is not opened." << std::endl;
+		return false;
+	}
+	const char* recName = record.GetRecName();
+	if (!recName)
+	{
+		std::cout << "Record name is invalid." << std::endl;
+		return false;
+	}
+	file.open(ColumnSnapshot::FileName(*db, recName), std::ios::in | std::ios::binary);
+	if (!file)
+	{
+		std::cout << "'" << recName << "' has no column snapshot." << std::endl;
+		return false;
+	}
+
+	COLHEADER head;
+	file.read((char*)(&head), sizeof(COLHEADER));
+	head.RecName[REC_NAME_SIZE - 1] = '\0';
+	if (file.gcount() != sizeof(COLHEADER) ||
+		memcmp(head.Magic, columnMagic, sizeof(columnMagic)) != 0 ||
+		head.Version != columnVersion ||
+		strcmp(head.RecName, recName) != 0 ||
+		head.BlockRows != static_cast<long long int>(ColumnSnapshot::BlockRows) ||
+		head.Rows < 0 || head.Columns <= 0)
+	{
+		std::cout << "Column snapshot of '" << recName << "' is invalid." << std::endl;
+		return false;
+	}
+	rows = head.Rows;
+	blocks = (rows + ColumnSnapshot::BlockRows - 1) / ColumnSnapshot::BlockRows;
+
+	COLUMNENTRY entry;
+	for (long long int i = 0; i < head.Columns; i++)
+	{
+		file.read((char*)(&entry), sizeof(COLUMNENTRY));
+		if (file.gcount() != sizeof(COLUMNENTRY) || entry.Size <= 0)
+		{
+			std::cout << "Column snapshot of '" << recName << "' is invalid." << std::endl;
+			return false;
+		}
+		Stored column;
+		column.offset = static_cast<std::size_t>(entry.Offset);
+		column.size = static_cast<std::size_t>(entry.Size);
+		column.zoned = entry.Kind >= 0;
+		column.kind = column.zoned ? static_cast<FieldKind>(entry.Kind) : FieldKind::Int64;
+		column.start = entry.Start;
+		columns.push_back(column);
+	}
+	ZONEENTRY entryZone;
+	zones.reserve(blocks * columns.size());
+	for (long long int b = 0; b < blocks; b++)
+	{
+		for (const Stored& column : columns)
+		{
+			file.read((char*)(&entryZone), sizeof(ZONEENTRY));
+			if (file.gcount() != sizeof(ZONEENTRY))
+			{
+				std::cout << "Column snapshot of '" << recName << "' is invalid." << std::endl;
+				return false;
+			}
+			SeekPlan::Zone zone;
+			zone.kind = column.kind;
+			zone.empty = !column.zoned;
+			zone.min = entryZone.Min;
+			zone.max = entryZone.Max;
+			zones.push_back(zone);
+		}
+	}
+	return true;
+}
+int ColumnScan::Find(std::size_t offset, std::size_t size) const
+{
+	for (std::size_t c = 0; c < columns.size(); c++)
+	{
+		if (columns[c].offset == offset && columns[c].size >= size)
+			return static_cast<int>(c);
+	}
+	return -1;
+}
+ColumnScan& ColumnScan::Select(std::size_t offset, std::size_t size)
+{
+	int c = Find(offset, size);
+	if (size == 0 || c == -1)
+	{
+		std::cout << "Field is not in the column snapshot." << std::endl;
+		valid = false;
+		return *this;
+	}
+	selected.push_back(c);
+	return *this;
+}
+bool ColumnScan::Load(Stored& column, long long b)
+{
+	if (column.block == b)
+		return true;
+	std::size_t n = static_cast<std::size_t>(std::min<long long>(ColumnSnapshot::BlockRows, rows - b * ColumnSnapshot::BlockRows));
+	column.data.resize(n * column.size + columnPadding);
+	file.clear();
+	file.seekg(column.start + static_cast<std::streamoff>(b * ColumnSnapshot::BlockRows * column.size), std::ios::beg);
+	file.read(column.data.data(), n * column.size);
+	if (file.gcount() != static_cast<std::streamsize>(n * column.size))
+	{
+		std::cerr << "Error: column snapshot is truncated." << std::endl;
+		column.block = -1;
+		return false;
+	}
+	column.block = b;
+	return true;
+}
+OpResult ColumnScan::Advance(void)
+{
+	if (!valid)
+		return OpResult::Null;
+	auto zoneOf = [this](const SeekPlan::Term& t) -> const SeekPlan::Zone*
+	{
+		std::size_t j = &t - plan.Terms().data();
+		return &zones[block * columns.size() + keyColumns[j]];
+	};
+	while (true)
+	{
+		for (; row < blockRows; row++)
+		{
+			if (SeekPlan::Selected(selection, row))
+			{
+				current = row++;
+				return OpResult::True;
+			}
+		}
+		if (block + 1 >= blocks)
+		{
+			block = blocks;
+			return OpResult::False;
+		}
+		block++;
+		row = 0;
+		blockRows = 0;
+		if (!plan.MayMatch(zoneOf))
+		{
+			skipped++;
+			continue;
+		}
+		read++;
+		std::size_t n = static_cast<std::size_t>(std::min<long long>(ColumnSnapshot::BlockRows, rows - block * ColumnSnapshot::BlockRows));
+		if (keyColumns.empty())
+		{
+			// Every record of the type
+			selection.assign((n + 63) / 64, ~0ULL);
+			blockRows = n;
+			continue;
+		}
+		std::vector<const char*> fields;
+		std::vector<std::size_t> strides;
+		for (int c : keyColumns)
+		{
+			if (!Load(columns[c], block))
+			{
+				valid = false;
+				return OpResult::Null;
+			}
+			fields.push_back(columns[c].data.data());
+			strides.push_back(columns[c].size);
+		}
+		try {
+			plan.MatchColumns(fields, strides, n, selection);
+		}
+		catch (const std::invalid_argument& e) {
+			std::cerr << "Invalid argument: " << e.what() << std::endl;
+			valid = false;
+			return OpResult::Null;
+		}
+		catch (const std::out_of_range& e) {
+			std::cerr << "Out of range: " << e.what() << std::endl;
+			valid = false;
+			return OpResult::Null;
+		}
+		blockRows = n;
+	}
+}
+OpResult ColumnScan::Next(void)
+{
+	OpResult ret = Advance();
+	if (ret != OpResult::True)
+		return ret;
+	if (!Load(columns[0], block))
+		return OpResult::Null;
+	for (int c : selected)
+	{
+		if (!Load(columns[c], block))
+			return OpResult::Null;
+	}
+	return ret;
+}
+std::size_t ColumnScan::Count(void)
+{
+	std::size_t count = 0;
+	while (Advance() == OpResult::True)
+		count++;
+	return count;
+}
+long long ColumnScan::PrimaryKey(void) const
+{
+	long long key;
+	memcpy(&key, columns[0].data.data() + current * sizeof(long long), sizeof(key));
+	return key;
+}
+const char* ColumnScan::Column(std::size_t i) const
+{
+	const Stored& column = columns[selected[i]];
+	return column.data.data() + current * column.size;
+}
+std::string ColumnScan::GetString(std::size_t i) const
+{
+	const char* s = Column(i);
+	return std::string(s, strnlen(s, columns[selected[i]].size));
+}
+std::size_t ColumnScan::BlocksRead(void) const
+{
+	return read;
+}
+std::size_t ColumnScan::BlocksSkipped(void) const
+{
+	return skipped;
+}
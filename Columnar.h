@@ -0,0 +1,107 @@
+#pragma once
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "Record.h"
+#include "SeekPlan.h"
+
+class Database;
+
+// A column snapshot of the live records of one type, written by
+// Database::ExportColumnar next to the data file (<file>.<RecName>.col).
+// Each exported field is one contiguous column, so a scan reads only the
+// fields it compares or returns. Columns are cut in blocks of BlockRows
+// records, and each block keeps the min and max of every integer, bool,
+// char and enum column. The snapshot is not updated by later writes.
+class ColumnSnapshot
+{
+public:
+	static const std::size_t BlockRows = 4096;
+
+	// fields are located like recKeys: offset, sz and typeInfo (value,
+	// comp and andOr are not used). The primary key is always exported.
+	static bool Write(Database& db, const std::string& recName, const std::vector<recKey*>& fields);
+	static std::string FileName(Database& db, const std::string& recName);
+};
+
+// A scan of a column snapshot: the rows matching a list of recKeys, like
+// a Seek/Next loop over the records when the snapshot was taken. Blocks
+// whose min and max rule the keys out are not read.
+//
+//	Person p;
+//	db.ExportColumnar("Person", { &age, &name });
+//	ColumnScan scan(p, { &k1, &k2 });
+//	scan.Select(8, sizeof(int)).Select(12, 16);
+//	while (scan.Next() == OpResult::True)
+//		std::cout << scan.PrimaryKey() << " " << scan.Get<int>(0) << " " << scan.GetString(1) << std::endl;
+//
+// Keys and selected fields must be exported columns. The keys must
+// outlive the scan.
+class ColumnScan
+{
+public:
+	ColumnScan(Record& record, const std::vector<recKey*>& keys);
+
+	// A field returned for each row, located like a recKey
+	ColumnScan& Select(std::size_t offset, std::size_t size);
+	// OpResult::True at the next match, False at the end, Null on error
+	OpResult Next(void);
+	// Matches left, without reading the selected columns
+	std::size_t Count(void);
+
+	long long PrimaryKey(void) const;
+	// The i-th selected field of the current row
+	const char* Column(std::size_t i) const;
+	template <typename T>
+	T Get(std::size_t i) const
+	{
+		T value;
+		memcpy(&value, Column(i), sizeof(T));
+		return value;
+	}
+	// A char array field, up to its first null
+	std::string GetString(std::size_t i) const;
+
+	// Blocks read and blocks skipped by their min and max so far
+	std::size_t BlocksRead(void) const;
+	std::size_t BlocksSkipped(void) const;
+
+private:
+	struct Stored
+	{
+		std::size_t offset;
+		std::size_t size;
+		bool zoned;           // min and max kept per block
+		FieldKind kind;
+		std::streamoff start; // of its data in the file
+		std::vector<char> data;   // the current block
+		long long block = -1;     // block in data
+	};
+
+	bool Open(Record& record);
+	// Column exported at offset, with room for size bytes; -1 if none
+	int Find(std::size_t offset, std::size_t size) const;
+	bool Load(Stored& column, long long block);
+	// Moves to the next matching row
+	OpResult Advance(void);
+
+	std::ifstream file;
+	std::vector<Stored> columns;
+	std::vector<SeekPlan::Zone> zones;   // block * columns.size() + column
+	long long rows = 0;
+	long long blocks = 0;
+
+	SeekPlan plan;
+	std::vector<int> keyColumns;         // column of each key
+	std::vector<int> selected;           // column of each Select
+	bool valid = true;
+
+	long long block = -1;                // block being scanned
+	std::size_t blockRows = 0;
+	std::size_t row = 0;                 // next row of it to look at
+	std::size_t current = 0;             // row of the current match
+	std::vector<unsigned long long> selection;
+	std::size_t read = 0;
+	std::size_t skipped = 0;
+};
@@ -0,0 +1,399 @@
+#include "Database.h"
+#include "Record.h"
+#include "Cursor.h"
+#include "Storage.h"
+#include <algorithm>
+#include <cctype> // for std::tolower
+#include <cstring>
+#include <iostream>
+
+Cursor::Cursor(Record& rec, const std::vector<recKey*>& k, std::streamoff from) :
+	record(&rec),
+	db(rec.GetDatabase()),
+	storage(db != nullptr ? &Storage::Get(db) : nullptr),
+	keys(k),
+	offset(from),
+	lastKey(from == 0 ? 0 : -1)
+{
+	if (storage != nullptr)
+		epoch = storage->Epoch();
+	// Parse the keys once; each record then only runs the compiled comparators
+	plan.Compile(keys, [&rec](std::string name) { return rec.GetEnumValue(name); });
+}
+Cursor::Cursor(Cursor&& other) :
+	record(other.record),
+	db(other.db),
+	storage(other.storage),
+	keys(std::move(other.keys)),
+	plan(std::move(other.plan)),
+	offset(other.offset),
+	epoch(other.epoch),
+	lastKey(other.lastKey),
+	pool(other.pool),
+	pin(other.pin),
+	version(other.version),
+	copy(std::move(other.copy)),
+	blockStart(other.blockStart),
+	blockRows(other.blockRows),
+	blockBits(std::move(other.blockBits)),
+	blockVersion(other.blockVersion)
+{
+	other.pin.frame = -1;
+}
+Cursor::~Cursor()
+{
+	if (pool != nullptr)
+		pool->Unpin(pin);
+}
+std::streamoff Cursor::Offset(void) const
+{
+	return offset;
+}
+unsigned long long Cursor::Epoch(void) const
+{
+	return epoch;
+}
+void Cursor::Continue(unsigned long long e, long long key)
+{
+	epoch = e;
+	lastKey = key;
+}
+Cursor::iterator Cursor::begin(void)
+{
+	return Next() == OpResult::True ? iterator(this) : end();
+}
+Cursor::iterator Cursor::end(void)
+{
+	return iterator(nullptr);
+}
+// Returns the constant of the first key if a field index can answer it. The
+// index is only used when the first key is a necessary condition, i.e. when
+// the keys are joined by AND only.
+static bool indexKey(const std::vector<recKey*>& keys, long long& key)
+{
+	if (keys.empty())
+		return false;
+	for (std::size_t i = 0; i + 1 < keys.size(); i++)
+	{
+		if (keys[i]->andOr == AndOr::Or)
+			return false;
+	}
+	recKey* k = keys[0];
+	if (k->comp == Comp::NotEqual || !Storage::IsIndexable(k))
+		return false;
+
+	if (k->typeInfo == typeid(bool))
+	{
+		std::string value = k->value;
+		std::transform(value.begin(), value.end(), value.begin(),
+			[](unsigned char c) { return std::tolower(c); });
+		if (k->comp != Comp::Equal)
+			return false;
+		if (value == "true" || value == "1")
+			key = 1;
+		else if (value == "false" || value == "0")
+			key = 0;
+		else
+			return false;
+	}
+	else if (k->typeInfo == typeid(char) ||
+		k->typeInfo == typeid(signed char) ||
+		k->typeInfo == typeid(unsigned char))
+	{
+		key = k->value.c_str()[0];
+	}
+	else
+	{
+		try {
+			key = std::stoll(k->value);
+		}
+		catch (...) {
+			return false;  // let the scan report it
+		}
+	}
+	return true;
+}
+// Pages read in one batch when a sequential scan reaches one not cached
+static const std::size_t readAheadPages = 8;
+
+// Bytes of the data file, through the mapping or the pinned page
+const char* Cursor::Fetch(std::streamoff at, std::size_t n, bool sequential)
+{
+	if (storage->IsMemoryMapped())
+		return storage->View(at, n);
+
+	pool = &storage->Pool();   // also writes out a pending transaction
+	if (version != storage->Version())
+	{
+		pool->Unpin(pin);
+		version = storage->Version();
+	}
+	std::streamoff page = at - at % static_cast<std::streamoff>(BufferPool::PageSize);
+	if (at + static_cast<std::streamoff>(n) > page + static_cast<std::streamoff>(BufferPool::PageSize))
+		return Copy(at, n);   // spans two pages
+	if (pin.frame == -1 || pin.start != page)
+	{
+		pool->Unpin(pin);
+		if (sequential && !pool->IsCached(page))
+		{
+			std::vector<std::streamoff> pages;
+			for (std::size_t i = 0; i < readAheadPages; i++)
+				pages.push_back(page + static_cast<std::streamoff>(i * BufferPool::PageSize));
+			pool->Prefetch(pages);
+		}
+		if (!pool->PinPage(at, pin))
+			return Copy(at, n);
+	}
+	if (at + static_cast<std::streamoff>(n) > pin.start + static_cast<std::streamoff>(pin.size))
+		return nullptr;   // end of the file
+	return pin.data + (at - pin.start);
+}
+// Bytes no single pinned page holds are copied into the cursor's own
+// buffer, which other cursors and views on this thread do not reuse
+const char* Cursor::Copy(std::streamoff at, std::size_t n)
+{
+	if (copy.size() < n)
+		copy.resize(n);
+	if (storage->Read(at, copy.data(), n) != n)
+		return nullptr;
+	return copy.data();
+}
+OpResult Cursor::Match(const char* body)
+{
+	if (keys.empty())
+		return OpResult::True;   // every record of the type
+	record->LastOpResult = OpResult::Null;
+	record->LastAndOr = AndOr::Null;
+	try {
+		record->LastOpResult = plan.Match(body);
+	}
+	catch (const std::invalid_argument& e) {
+		std::cerr << "Invalid argument: " << e.what() << std::endl;
+		return OpResult::Null;
+	}
+	catch (const std::out_of_range& e) {
+		std::cerr << "Out of range: " << e.what() << std::endl;
+		return OpResult::Null;
+	}
+	return record->LastOpResult;
+}
+bool Cursor::MatchBlock(std::streamoff& at, std::streamoff end, int recSz, const char* recName, bool& matched)
+{
+	const std::streamoff size = recSz;
+	bool current = blockVersion == storage->Version() && at >= blockStart &&
+		at < blockStart + static_cast<std::streamoff>(blockRows) * size && (at - blockStart) % size == 0;
+	const char* block;
+	if (current)
+		block = Fetch(blockStart, blockRows * recSz, true);
+	else
+	{
+		if (!storage->IsMemoryMapped())
+		{
+			// The rest of the page, so that it stays pinned
+			std::streamoff page = at - at % static_cast<std::streamoff>(BufferPool::PageSize);
+			end = std::min(end, page + static_cast<std::streamoff>(BufferPool::PageSize));
+		}
+		std::size_t rows = std::min<std::size_t>(SeekPlan::BlockRows, static_cast<std::size_t>((end - at) / size));
+		block = nullptr;
+		while (rows >= SeekPlan::MinBlockRows && (block = Fetch(at, rows * recSz, true)) == nullptr)
+			rows /= 2;
+		if (block == nullptr)
+			return false;
+		// Up to the first record of another size: a free slot split
+		// differently, or the end of the data
+		for (std::size_t i = 1; i < rows; i++)
+		{
+			int sz;
+			std::memcpy(&sz, block + i * recSz, sizeof(sz));
+			if (sz != recSz)
+			{
+				rows = i;
+				break;
+			}
+		}
+		plan.MatchBatch(block + sizeof(int) + REC_NAME_SIZE, recSz, rows, blockBits);
+		blockStart = at;
+		blockRows = rows;
+		blockVersion = storage->Version();
+	}
+	if (block == nullptr)
+		return false;
+
+	// Records of other types and free slots in the block may match too
+	for (std::size_t i = static_cast<std::size_t>((at - blockStart) / size); i < blockRows; i++)
+	{
+		if (SeekPlan::Selected(blockBits, i) &&
+			strncmp(block + i * recSz + sizeof(int), recName, REC_NAME_SIZE) == 0)
+		{
+			at = blockStart + static_cast<std::streamoff>(i) * size;
+			matched = true;
+			return true;
+		}
+	}
+	at = blockStart + static_cast<std::streamoff>(blockRows) * size;
+	matched = false;
+	return true;
+}
+OpResult Cursor::Next(void)
+{
+	if (db == nullptr || !db->IsOpen())
+	{
+		std::cout << "Database is not opened." << std::endl;
+		return OpResult::Null;
+	}
+	// The view points into the file; load it before a writer can move it
+	Storage::Access access(*storage, false);
+	RecordView view;
+	OpResult ret = Advance(view);
+	if (ret == OpResult::True)
+	{
+		const std::size_t header = sizeof(int) + REC_NAME_SIZE;
+		memcpy((void*)(record->GetDataAddress() + header), view.data + header, view.size - header);
+		record->recordDBAddress = view.offset;
+	}
+	return ret;
+}
+OpResult Cursor::Next(RecordView& view)
+{
+	return Advance(view);
+}
+OpResult Cursor::Advance(RecordView& view)
+{
+	if (db == nullptr || !db->IsOpen())
+	{
+		std::cout << "Database is not opened." << std::endl;
+		return OpResult::Null;
+	}
+	const char* recName = record->GetRecName();
+	if (!recName)
+	{
+		std::cout << "Record name is invalid." << std::endl;
+		return OpResult::Null;
+	}
+	Storage::Access access(*storage, false);
+
+	const std::size_t header = sizeof(int) + REC_NAME_SIZE;
+	auto found = [&](std::streamoff at, int recSz, const char* rec)
+	{
+		view.offset = at;
+		view.size = recSz;
+		view.data = rec;
+		offset = at + recSz;
+		std::memcpy(&lastKey, rec + header, sizeof(lastKey));
+	};
+	if (epoch != storage->Epoch())
+	{
+		// Compact moved the records; they keep their order within a type,
+		// so the scan goes on after the last match, wherever it is now
+		std::streamoff at;
+		const char* buff;
+		if (lastKey == 0)
+			offset = 0;
+		else if (lastKey > 0 && storage->FindRecord(lastKey, at) && (buff = Fetch(at, header)) != nullptr)
+		{
+			int size;
+			std::memcpy(&size, buff, sizeof(size));
+			offset = at + size;
+		}
+		else
+		{
+			std::cout << "The database was compacted during the scan." << std::endl;
+			return OpResult::Null;
+		}
+		epoch = storage->Epoch();
+	}
+	int recSz = 0;
+	long long key;
+	std::shared_ptr<const std::vector<std::streamoff>> candidates;
+	if (indexKey(keys, key) && storage->FieldCandidates(recName, keys[0], key, candidates))
+	{
+		// Only visit the records the index selected, in file order
+		for (auto it = std::lower_bound(candidates->begin(), candidates->end(), offset); it != candidates->end(); ++it)
+		{
+			const char* buff = Fetch(*it, header);
+			if (buff == nullptr)
+				break;
+			std::memcpy(&recSz, buff, sizeof(recSz));
+			if (recSz < static_cast<int>(header))
+				break;
+			const char* rec = Fetch(*it, recSz);
+			if (rec == nullptr)
+				break;
+			OpResult ret = Match(rec + header);
+			if (ret == OpResult::Null)
+				return ret;
+			if (ret == OpResult::True)
+			{
+				found(*it, recSz, rec);
+				return ret;
+			}
+		}
+		if (!candidates->empty())
+			offset = std::max(offset, candidates->back() + 1);
+		return OpResult::False;
+	}
+
+	char name[REC_NAME_SIZE];
+	const bool batched = plan.Batchable();
+	const int dataSize = record->GetDataSize();
+	std::streamoff extentEnd;
+	// Blocks of the file whose zones rule the keys out are stepped over
+	std::vector<const Storage::ZoneMap*> zoneMaps;
+	storage->ZoneMaps(recName, plan, zoneMaps);
+	const bool zoned = std::any_of(zoneMaps.begin(), zoneMaps.end(), [](const Storage::ZoneMap* m) { return m != nullptr; });
+	std::streamoff zoneBlock = -1;
+	// Only the extents holding this record type are visited
+	while (storage->NextOfType(recName, offset, &extentEnd))
+	{
+		if (zoned && offset / static_cast<std::streamoff>(Storage::ZoneBytes) != zoneBlock)
+		{
+			std::streamoff end;
+			zoneBlock = offset / static_cast<std::streamoff>(Storage::ZoneBytes);
+			if (!Storage::BlockMayMatch(plan, zoneMaps, offset, end))
+			{
+				offset = end;
+				continue;
+			}
+		}
+		const char* buff = Fetch(offset, header, true);
+		if (buff == nullptr)
+			break;
+
+		std::memcpy(&recSz, buff, sizeof(recSz));
+		std::memcpy(name, buff + sizeof(int), REC_NAME_SIZE);
+		if (recSz < static_cast<int>(header))
+			break;
+		if (strcmp(name, recName) != 0)
+		{
+			offset += recSz;
+			continue;
+		}
+		bool matched;
+		if (batched && recSz == dataSize && MatchBlock(offset, extentEnd, recSz, recName, matched))
+		{
+			if (!matched)
+				continue;
+			const char* rec = Fetch(offset, recSz, true);
+			if (rec == nullptr)
+				break;
+			record->LastOpResult = OpResult::True;
+			record->LastAndOr = AndOr::Null;
+			found(offset, recSz, rec);
+			return OpResult::True;
+		}
+		const char* rec = Fetch(offset, recSz, true);
+		if (rec == nullptr)
+			break;
+
+		OpResult ret = Match(rec + header);
+		if (ret == OpResult::Null)
+			return ret;
+		if (ret == OpResult::True)
+		{
+			found(offset, recSz, rec);
+			return ret;
+		}
+		offset += recSz;
+	}
+	return OpResult::False;
+}
@@ -0,0 +1,132 @@
+#pragma once
+#include <cstring>
+#include <memory>
+#include <vector>
+#include "Record.h"
+#include "BufferPool.h"
+#include "SeekPlan.h"
+
+class Database;
+class Storage;
+
+// A record as it lies in the data file, header included, read without
+// copying it into a Record. The bytes are in the file mapping, a pinned
+// page or a copy owned by the cursor, and stay valid until the cursor
+// moves or the database is written.
+struct RecordView
+{
+	std::streamoff offset = -1;
+	int size = 0;
+	const char* data = nullptr;
+
+	// Field at a recKey offset (counted from the byte after RecName)
+	template <typename T>
+	T Field(std::size_t fieldOffset) const
+	{
+		T value;
+		memcpy(&value, data + sizeof(int) + REC_NAME_SIZE + fieldOffset, sizeof(T));
+		return value;
+	}
+	// The record's packed data struct, in place
+	template <typename T>
+	const T* As(void) const
+	{
+		return reinterpret_cast<const T*>(data);
+	}
+	long long PrimaryKey(void) const
+	{
+		return Field<long long>(0);
+	}
+};
+
+// A position in a scan over the records of one type that match a list of
+// recKeys. Each cursor keeps its own file offset, compiled keys and pinned
+// page, so several can be open at once and other calls do not move them.
+// Next loads the next match into the record the cursor was opened on; use
+// one record object per cursor.
+//
+//	Person p;
+//	for (Record& r : p.Scan(&k1, &k2, nullptr))
+//		r.Dump();
+//
+// The keys are parsed when the cursor is opened and must outlive it, and
+// the cursor must not outlive the database.
+class Cursor
+{
+public:
+	Cursor(Record& record, const std::vector<recKey*>& keys, std::streamoff offset = 0);
+	Cursor(Cursor&& other);
+	Cursor(const Cursor&) = delete;
+	Cursor& operator=(const Cursor&) = delete;
+	~Cursor();
+
+	// OpResult::True and the record loaded, False at the end, Null on error
+	OpResult Next(void);
+	// Same, but only points view at the match; the record is not loaded
+	OpResult Next(RecordView& view);
+	// Offset the next call to Next starts from
+	std::streamoff Offset(void) const;
+	// Compaction epoch of Offset (see Storage::Epoch)
+	unsigned long long Epoch(void) const;
+	// A cursor opened at an offset another cursor stopped at: its epoch
+	// and the primary key of its last match (0: none). If Compact moved
+	// the records since, the scan goes on after that record.
+	void Continue(unsigned long long epoch, long long lastKey);
+
+	class iterator
+	{
+	public:
+		explicit iterator(Cursor* cursor) : cursor(cursor) {}
+		Record& operator*() const { return *cursor->record; }
+		Record* operator->() const { return cursor->record; }
+		iterator& operator++()
+		{
+			if (cursor->Next() != OpResult::True)
+				cursor = nullptr;
+			return *this;
+		}
+		bool operator==(const iterator& other) const { return cursor == other.cursor; }
+		bool operator!=(const iterator& other) const { return cursor != other.cursor; }
+	private:
+		Cursor* cursor;   // nullptr: end
+	};
+	// Loads the first match (from the current offset)
+	iterator begin(void);
+	iterator end(void);
+
+private:
+	// sequential: a scan in file order, which reads ahead
+	const char* Fetch(std::streamoff at, std::size_t n, bool sequential = false);
+	const char* Copy(std::streamoff at, std::size_t n);
+	OpResult Match(const char* body);
+	// Moves to the next match; view points at it
+	OpResult Advance(RecordView& view);
+	// Evaluates the keys for a block of records of recSz bytes from at up
+	// to end at most (or reuses the last block, which holds at) and moves
+	// at to the first match of the type in it, setting matched, or past
+	// the block. False when no block can be read there.
+	bool MatchBlock(std::streamoff& at, std::streamoff end, int recSz, const char* recName, bool& matched);
+
+	Record* record;
+	Database* db;
+	Storage* storage;   // of db, looked up once
+	std::vector<recKey*> keys;
+	SeekPlan plan;
+	std::streamoff offset;
+	unsigned long long epoch = 0;
+	long long lastKey;   // of the last match; 0: none yet, -1: not known
+
+	// When the file is not memory mapped the page being read stays pinned
+	// in the buffer pool; it is valid for version of the data file
+	BufferPool* pool = nullptr;
+	BufferPool::Pin pin;
+	unsigned long long version = 0;
+	std::vector<char> copy;   // a record that spans two pages, or is not cached
+
+	// Selection of the last block MatchBlock evaluated, valid for
+	// blockVersion of the data file
+	std::streamoff blockStart = -1;
+	std::size_t blockRows = 0;
+	std::vector<unsigned long long> blockBits;
+	unsigned long long blockVersion = 0;
+};
@@ -1,5 +1,7 @@
 #include "Database.h"
 #include "Record.h"
+#include "Storage.h"
+#include "Columnar.h"
 
 #pragma pack(push, 1)  // Aligns members on 1-byte boundaries
 struct HEADER
@@ -19,6 +21,7 @@ Database::Database(std::string fileName)
 
 // Destructor
 Database::~Database(void) {
+	Storage::Release(this);
 	if (outFile.is_open()) {
 		outFile.close();
 	}
@@ -30,6 +33,9 @@ const std::string  Database::GetDatabaseName(void)
 // Method to connect to the file
 std::fstream& Database::Connect(std::string outFileName)
 {
+	// Queued async writes run first, as in Close; they need the lock taken below
+	Storage::Get(this).IO().Drain();
+	Storage::Access access(Storage::Get(this), true);
 	if (IsOpen())
 		Close();
 
@@ -44,85 +50,218 @@ std::fstream& Database::Connect(std::string outFileName)
 	}
 	Record::setDatabase(*this);
 	FileName = outFileName;
+	Storage::Get(this).Open(outFile, FileName);
 
 	return outFile;
 }
+void Database::SetMemoryMapped(bool on)
+{
+	Storage::Access access(Storage::Get(this), true);
+	Storage::Get(this).SetMemoryMapped(on);
+}
+bool Database::IsMemoryMapped(void)
+{
+	return Storage::Get(this).IsMemoryMapped();
+}
+// Memory budget of the page cache used when the file is not memory mapped
+void Database::SetCacheSize(std::size_t bytes)
+{
+	Storage::Get(this).Pool().SetBudget(bytes);
+}
+void Database::GetCacheStats(unsigned long long& hits, unsigned long long& misses)
+{
+	hits = Storage::Get(this).Pool().Hits();
+	misses = Storage::Get(this).Pool().Misses();
+}
+// Number of records kept by the cache of Record::GetSharedRecord; 0 (the
+// default) turns it off
+void Database::SetObjectCacheSize(std::size_t records)
+{
+	Storage::Get(this).Objects().SetSize(records);
+}
+void Database::GetObjectCacheStats(unsigned long long& hits, unsigned long long& misses)
+{
+	hits = Storage::Get(this).Objects().Hits();
+	misses = Storage::Get(this).Objects().Misses();
+}
+// Threads used by Record::SeekAll; 0 uses one per core
+void Database::SetScanThreads(unsigned int threads)
+{
+	Storage::Get(this).SetScanThreads(threads);
+}
+// Appends all records to this database with one write per chunk
+bool Database::BulkInsert(std::vector<Record*>& records)
+{
+	if (!IsOpen())
+	{
+		std::cout << "Database is not opened." << std::endl;
+		return false;
+	}
+	for (Record* rec : records)
+	{
+		if (rec != nullptr)
+			rec->UseDatabase(*this);
+	}
+	return Record::InsertBatch(records);
+}
+// Loads the records of many primary keys in one pass over the file;
+// records[i] is nullptr when keys[i] is not found. The caller deletes them.
+bool Database::MultiGet(const std::vector<long long>& keys, std::vector<Record*>& records)
+{
+	if (!IsOpen())
+	{
+		std::cout << "Database is not opened." << std::endl;
+		records.assign(keys.size(), nullptr);
+		return false;
+	}
+	return Record::GetRecordsByIndex(*this, keys, records);
+}
+// Writes a column snapshot of the live records of recName, for analytical
+// scans (ColumnScan) that read only the fields they use. fields are the
+// fields to export, located like recKeys.
+bool Database::ExportColumnar(std::string recName, const std::vector<recKey*>& fields)
+{
+	if (!IsOpen())
+	{
+		std::cout << "Database is not opened." << std::endl;
+		return false;
+	}
+	return ColumnSnapshot::Write(*this, recName, fields);
+}
+// Rewrites the file without deleted records; returns the bytes reclaimed
+long long Database::Compact(void)
+{
+	if (!IsOpen())
+	{
+		std::cout << "Database is not opened." << std::endl;
+		return -1;
+	}
+	Storage::Get(this).IO().Drain();
+	return Storage::Get(this).Compact();
+}
+// Transactions: writes between BeginTransaction and Commit are logged to
+// the write-ahead log and made durable together by Commit
+bool Database::BeginTransaction(void)
+{
+	if (!IsOpen())
+	{
+		std::cout << "Database is not opened." << std::endl;
+		return false;
+	}
+	Storage::Access access(Storage::Get(this), true);
+	return Storage::Get(this).Begin();
+}
+bool Database::Commit(void)
+{
+	if (!IsOpen())
+	{
+		std::cout << "Database is not opened." << std::endl;
+		return false;
+	}
+	Storage::Get(this).IO().Drain();
+	Storage::Access access(Storage::Get(this), true);
+	return Storage::Get(this).Commit();
+}
+bool Database::Rollback(void)
+{
+	if (!IsOpen())
+	{
+		std::cout << "Database is not opened." << std::endl;
+		return false;
+	}
+	Storage::Get(this).IO().Drain();
+	Storage::Access access(Storage::Get(this), true);
+	return Storage::Get(this).Rollback();
+}
 bool Database::IsOpen(void)
 {
 	return outFile.is_open();
 }
 int Database::Close(void)
 {
+	// Queued async writes run first; they need the lock taken below
+	Storage::Get(this).IO().Drain();
+	Storage::Access access(Storage::Get(this), true);
 	if (IsOpen())
 	{
+		Storage::Get(this).Close();
 		outFile.close();
 		return 0;
 	}
 	return 1;
 }
+// Records in the file, deleted ones included; kept by the writes
 long Database::GetCount(void)
 {
-	long cnt = 0;
-	struct HEADER
+	Storage::Access access(Storage::Get(this), false);
+	if (!IsOpen())
+		return 0;
+	return static_cast<long>(Storage::Get(this).RecordCount());
+}
+// Live records of one type; deleted records are not counted
+long Database::GetCount(std::string recName)
+{
+	if (!IsOpen())
 	{
-		int RecSize;
-		char RecName[REC_NAME_SIZE];
-		long long int primaryKey;
-	} header;
-	outFile.seekg(0, std::ios::beg);
-	while (true)
+		std::cout << "Database is not opened." << std::endl;
+		return 0;
+	}
+	Storage::Access access(Storage::Get(this), false);
+	return static_cast<long>(Storage::Get(this).LiveCount(recName));
+}
+// Live records of every type
+void Database::GetCounts(std::map<std::string, long>& counts)
+{
+	counts.clear();
+	if (!IsOpen())
 	{
-		outFile.read((char*)(&header), sizeof(HEADER));
-		if (outFile.gcount() != sizeof(HEADER) || header.RecSize == 0)
-		{
-			outFile.clear();
-			break;
-		}
-
-		outFile.seekg(header.RecSize - sizeof(HEADER), std::ios::cur);
-		cnt++;
+		std::cout << "Database is not opened." << std::endl;
+		return;
 	}
-	return cnt;
+	Storage::Access access(Storage::Get(this), false);
+	Storage::Get(this).LiveCounts(counts);
 }
-int Database::Dump(std::string recName)
+// Deleted records (free slots) of every type. Records deleted before the
+// index was last rebuilt from the data file are counted under "".
+void Database::GetDeletedCounts(std::map<std::string, long>& counts)
 {
-	if (Record::db == nullptr)
+	counts.clear();
+	if (!IsOpen())
 	{
-		std::cout << "Database was not created in the application." << std::endl;
-		return 1;
+		std::cout << "Database is not opened." << std::endl;
+		return;
 	}
+	Storage::Access access(Storage::Get(this), false);
+	Storage::Get(this).DeletedCounts(counts);
+}
+int Database::Dump(std::string recName)
+{
 	if (!IsOpen())
 	{
 		std::cout << "Database is not opened." << std::endl;
 		return 1;
 
 	}
+	Storage::Access access(Storage::Get(this), false);
 	HEADER header;
-	outFile.clear();
-	outFile.seekg(0, std::ios::beg);
+	std::streamoff offset = 0;
 	long long int cnt = 0;
-	while (true)
+	while (Storage::Get(this).NextOfType(recName.c_str(), offset))
 	{
 		std::cout << std::endl;
-		outFile.read((char*)(&header), sizeof(HEADER));
-		if (outFile.gcount() != sizeof(HEADER) || header.RecSize == 0)
-		{
-			outFile.clear();
+		const char* data = Storage::Get(this).View(offset, sizeof(HEADER));
+		if (data == nullptr)
+			break;
+		memcpy(&header, data, sizeof(HEADER));
+		if (header.RecSize == 0)
 			break;
-		}
+		offset += header.RecSize;
 		if (recName != header.RecName)
-		{
-			outFile.seekg(header.RecSize - sizeof(HEADER), std::ios::cur);
 			continue;
-		}
-		std::streampos savedPosition = outFile.tellp();
-		Record* rec = Record::GetRecordByIndex(header.primaryKey);
+		Record* rec = Record::GetRecordByIndex(*this, header.primaryKey);
 		if (rec)
 			rec->Dump();
 		delete rec;
-		outFile.seekp(savedPosition);
-
-		outFile.seekg(header.RecSize - sizeof(HEADER), std::ios::cur);
 		cnt++;
 	}
 	std::cout << "Total number of records " << cnt << std::endl << std::endl;
@@ -131,40 +270,32 @@ int Database::Dump(std::string recName)
 
 int Database::Dump(void)
 {
-	if (Record::db == nullptr)
-	{
-		std::cout << "Database was not created in the application." << std::endl;
-		return 1;
-	}
 	if (!IsOpen())
 	{
 		std::cout << "Database is not opened." << std::endl;
 		return 1;
 
 	}
+	Storage::Access access(Storage::Get(this), false);
 	HEADER header;
-	outFile.clear();
-	outFile.seekg(0, std::ios::beg);
+	std::streamoff offset = 0;
 	long long int cnt = 0;
 	while (true)
 	{
 		std::cout << std::endl;
-		outFile.read((char*)(&header), sizeof(HEADER));
-		if (outFile.gcount() != sizeof(HEADER) || header.RecSize == 0)
-		{
-			outFile.clear();
+		const char* data = Storage::Get(this).View(offset, sizeof(HEADER));
+		if (data == nullptr)
 			break;
-		}
+		memcpy(&header, data, sizeof(HEADER));
+		if (header.RecSize == 0)
+			break;
+		offset += header.RecSize;
 		if (!header.primaryKey)
 			continue;
-		std::streampos savedPosition = outFile.tellp();
-		Record* rec = Record::GetRecordByIndex(header.primaryKey);
+		Record* rec = Record::GetRecordByIndex(*this, header.primaryKey);
 		if (rec)
 			rec->Dump();
 		delete rec;
-		outFile.seekp(savedPosition);
-
-		outFile.seekg(header.RecSize - sizeof(HEADER), std::ios::cur);
 		cnt++;
 	}
 	std::cout << "Total number of records " << cnt << std::endl << std::endl;
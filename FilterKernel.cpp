@@ -0,0 +1,380 @@
+#include "FilterKernel.h"
+#include <atomic>
+#include <cstring>
+#include <functional>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define SYSCPPCP_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define SYSCPPCP_TARGET(isa)
+#else
+#define SYSCPPCP_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+static inline void setBits(unsigned long long* bits, std::size_t row, unsigned long long mask)
+{
+	// row is a multiple of the lanes, so the mask does not cross a word
+	bits[row / 64] |= mask << (row % 64);
+}
+
+// Scalar kernel, also used for the rows the vector kernels leave
+template <typename T, typename Op>
+static void filterRows(const char* field, std::size_t stride, std::size_t from, std::size_t count,
+	T key, unsigned long long* bits)
+{
+	Op op;
+	for (std::size_t i = from; i < count; i++)
+	{
+		T value;
+		memcpy(&value, field + i * stride, sizeof(T));
+		if (op(value, key))
+			bits[i / 64] |= 1ULL << (i % 64);
+	}
+}
+template <typename T>
+static void filterScalar(const char* field, std::size_t stride, std::size_t from, std::size_t count,
+	Comp comp, T key, unsigned long long* bits)
+{
+	switch (comp)
+	{
+	case Comp::Equal:
+		filterRows<T, std::equal_to<>>(field, stride, from, count, key, bits);
+		break;
+	case Comp::NotEqual:
+		filterRows<T, std::not_equal_to<>>(field, stride, from, count, key, bits);
+		break;
+	case Comp::Greater:
+		filterRows<T, std::greater<>>(field, stride, from, count, key, bits);
+		break;
+	case Comp::Smaller:
+		filterRows<T, std::less<>>(field, stride, from, count, key, bits);
+		break;
+	case Comp::GreaterEq:
+		filterRows<T, std::greater_equal<>>(field, stride, from, count, key, bits);
+		break;
+	case Comp::SmallerEq:
+		filterRows<T, std::less_equal<>>(field, stride, from, count, key, bits);
+		break;
+	default:
+		break;
+	}
+}
+static void filterScalar(const char* field, std::size_t stride, std::size_t from, std::size_t count,
+	FieldKind kind, Comp comp, long long key, unsigned long long* bits)
+{
+	switch (kind)
+	{
+	case FieldKind::Int8:
+		filterScalar<signed char>(field, stride, from, count, comp, static_cast<signed char>(key), bits);
+		break;
+	case FieldKind::UInt8:
+		filterScalar<unsigned char>(field, stride, from, count, comp, static_cast<unsigned char>(key), bits);
+		break;
+	case FieldKind::Int16:
+		filterScalar<short>(field, stride, from, count, comp, static_cast<short>(key), bits);
+		break;
+	case FieldKind::UInt16:
+		filterScalar<unsigned short>(field, stride, from, count, comp, static_cast<unsigned short>(key), bits);
+		break;
+	case FieldKind::Int32:
+		filterScalar<int>(field, stride, from, count, comp, static_cast<int>(key), bits);
+		break;
+	case FieldKind::UInt32:
+		filterScalar<unsigned int>(field, stride, from, count, comp, static_cast<unsigned int>(key), bits);
+		break;
+	case FieldKind::Int64:
+		filterScalar<long long>(field, stride, from, count, comp, key, bits);
+		break;
+	case FieldKind::UInt64:
+		filterScalar<unsigned long long>(field, stride, from, count, comp, static_cast<unsigned long long>(key), bits);
+		break;
+	}
+}
+
+#ifdef SYSCPPCP_X86
+// Fields narrower than 4 bytes are gathered as 32 bits and then extended;
+// the last record's field is left to the scalar kernel so that the wider
+// load stays inside the block
+static std::size_t vectorRows(FieldKind kind, std::size_t count)
+{
+	bool narrow = kind == FieldKind::Int8 || kind == FieldKind::UInt8 ||
+		kind == FieldKind::Int16 || kind == FieldKind::UInt16;
+	return narrow && count > 0 ? count - 1 : count;
+}
+
+SYSCPPCP_TARGET("avx2")
+static __m256i widen32Avx2(__m256i v, FieldKind kind)
+{
+	switch (kind)
+	{
+	case FieldKind::Int8:
+		return _mm256_srai_epi32(_mm256_slli_epi32(v, 24), 24);
+	case FieldKind::UInt8:
+		return _mm256_and_si256(v, _mm256_set1_epi32(0xFF));
+	case FieldKind::Int16:
+		return _mm256_srai_epi32(_mm256_slli_epi32(v, 16), 16);
+	case FieldKind::UInt16:
+		return _mm256_and_si256(v, _mm256_set1_epi32(0xFFFF));
+	case FieldKind::UInt32:
+		// Unsigned order through a signed compare
+		return _mm256_xor_si256(v, _mm256_set1_epi32(static_cast<int>(0x80000000u)));
+	default:
+		return v;
+	}
+}
+// Lanes where "value comp key" holds, from the greater and equal masks
+SYSCPPCP_TARGET("avx2")
+static unsigned int laneMaskAvx2(__m256i greater, __m256i smaller, __m256i equal, Comp comp, bool wide)
+{
+	__m256i m;
+	bool invert = false;
+	switch (comp)
+	{
+	case Comp::Equal: m = equal; break;
+	case Comp::NotEqual: m = equal; invert = true; break;
+	case Comp::Greater: m = greater; break;
+	case Comp::Smaller: m = smaller; break;
+	case Comp::GreaterEq: m = smaller; invert = true; break;
+	case Comp::SmallerEq: m = greater; invert = true; break;
+	default: return 0;
+	}
+	unsigned int lanes = wide ? 4 : 8;
+	unsigned int bits = wide ? _mm256_movemask_pd(_mm256_castsi256_pd(m)) : _mm256_movemask_ps(_mm256_castsi256_ps(m));
+	return invert ? ~bits & ((1u << lanes) - 1) : bits;
+}
+SYSCPPCP_TARGET("avx2")
+static std::size_t filterAvx2(const char* field, std::size_t stride, std::size_t count,
+	FieldKind kind, Comp comp, long long key, unsigned long long* bits)
+{
+	std::size_t rows = vectorRows(kind, count);
+	std::size_t i = 0;
+	if (kind == FieldKind::Int64 || kind == FieldKind::UInt64)
+	{
+		const __m128i index = _mm_mullo_epi32(_mm_setr_epi32(0, 1, 2, 3), _mm_set1_epi32(static_cast<int>(stride)));
+		const __m256i bias = _mm256_set1_epi64x(kind == FieldKind::UInt64 ? static_cast<long long>(0x8000000000000000ULL) : 0);
+		const __m256i k = _mm256_xor_si256(_mm256_set1_epi64x(key), bias);
+		for (; i + 4 <= rows; i += 4)
+		{
+			__m256i v = _mm256_i32gather_epi64(reinterpret_cast<const long long*>(field + i * stride), index, 1);
+			v = _mm256_xor_si256(v, bias);
+			unsigned int m = laneMaskAvx2(_mm256_cmpgt_epi64(v, k), _mm256_cmpgt_epi64(k, v), _mm256_cmpeq_epi64(v, k), comp, true);
+			setBits(bits, i, m);
+		}
+		return i;
+	}
+	const __m256i index = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(static_cast<int>(stride)));
+	int key32 = static_cast<int>(key);
+	if (kind == FieldKind::UInt32)
+		key32 = static_cast<int>(static_cast<unsigned int>(key) ^ 0x80000000u);
+	const __m256i k = _mm256_set1_epi32(key32);
+	for (; i + 8 <= rows; i += 8)
+	{
+		__m256i v = _mm256_i32gather_epi32(reinterpret_cast<const int*>(field + i * stride), index, 1);
+		v = widen32Avx2(v, kind);
+		unsigned int m = laneMaskAvx2(_mm256_cmpgt_epi32(v, k), _mm256_cmpgt_epi32(k, v), _mm256_cmpeq_epi32(v, k), comp, false);
+		setBits(bits, i, m);
+	}
+	return i;
+}
+
+// GCC's AVX-512 intrinsics start from an undefined vector, which it then
+// warns about once they are inlined
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+// Predicates of the AVX-512 integer compares (_MM_CMPINT_*)
+enum { CmpEq = 0, CmpLt = 1, CmpLe = 2, CmpNe = 4, CmpNlt = 5, CmpNle = 6 };
+
+SYSCPPCP_TARGET("avx512f")
+static __m512i widen32Avx512(__m512i v, FieldKind kind)
+{
+	switch (kind)
+	{
+	case FieldKind::Int8:
+		return _mm512_srai_epi32(_mm512_slli_epi32(v, 24), 24);
+	case FieldKind::UInt8:
+		return _mm512_and_si512(v, _mm512_set1_epi32(0xFF));
+	case FieldKind::Int16:
+		return _mm512_srai_epi32(_mm512_slli_epi32(v, 16), 16);
+	case FieldKind::UInt16:
+		return _mm512_and_si512(v, _mm512_set1_epi32(0xFFFF));
+	default:
+		return v;
+	}
+}
+SYSCPPCP_TARGET("avx512f")
+static std::size_t filterAvx512(const char* field, std::size_t stride, std::size_t count,
+	FieldKind kind, Comp comp, long long key, unsigned long long* bits)
+{
+	std::size_t rows = vectorRows(kind, count);
+	std::size_t i = 0;
+	// The compare predicate is an immediate, so each one is its own loop
+#define SYSCPPCP_FILTER512(cmp)                                                      \
+	switch (comp)                                                                    \
+	{                                                                                \
+	case Comp::Equal: SYSCPPCP_LOOP512(cmp, CmpEq) break;                            \
+	case Comp::NotEqual: SYSCPPCP_LOOP512(cmp, CmpNe) break;                         \
+	case Comp::Greater: SYSCPPCP_LOOP512(cmp, CmpNle) break;                         \
+	case Comp::Smaller: SYSCPPCP_LOOP512(cmp, CmpLt) break;                          \
+	case Comp::GreaterEq: SYSCPPCP_LOOP512(cmp, CmpNlt) break;                       \
+	case Comp::SmallerEq: SYSCPPCP_LOOP512(cmp, CmpLe) break;                        \
+	default: break;                                                                  \
+	}
+	if (kind == FieldKind::Int64 || kind == FieldKind::UInt64)
+	{
+		const __m256i index = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(static_cast<int>(stride)));
+		const __m512i k = _mm512_set1_epi64(key);
+#define SYSCPPCP_LOOP512(cmp, pred)                                                  \
+		for (; i + 8 <= rows; i += 8)                                                \
+		{                                                                            \
+			__m512i v = _mm512_i32gather_epi64(index, field + i * stride, 1);        \
+			setBits(bits, i, cmp(v, k, pred));                                       \
+		}
+		if (kind == FieldKind::UInt64)
+		{
+			SYSCPPCP_FILTER512(_mm512_cmp_epu64_mask)
+		}
+		else
+		{
+			SYSCPPCP_FILTER512(_mm512_cmp_epi64_mask)
+		}
+#undef SYSCPPCP_LOOP512
+		return i;
+	}
+	const __m512i index = _mm512_mullo_epi32(_mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15),
+		_mm512_set1_epi32(static_cast<int>(stride)));
+	const __m512i k = _mm512_set1_epi32(static_cast<int>(key));
+	const bool isSigned = kind == FieldKind::Int8 || kind == FieldKind::Int16 || kind == FieldKind::Int32;
+#define SYSCPPCP_LOOP512(cmp, pred)                                                  \
+	for (; i + 16 <= rows; i += 16)                                                  \
+	{                                                                                \
+		__m512i v = widen32Avx512(_mm512_i32gather_epi32(index, field + i * stride, 1), kind);  \
+		setBits(bits, i, cmp(v, k, pred));                                           \
+	}
+	if (isSigned)
+	{
+		SYSCPPCP_FILTER512(_mm512_cmp_epi32_mask)
+	}
+	else
+	{
+		SYSCPPCP_FILTER512(_mm512_cmp_epu32_mask)
+	}
+#undef SYSCPPCP_LOOP512
+#undef SYSCPPCP_FILTER512
+	return i;
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+static SimdLevel supportedLevel(void)
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return SimdLevel::Scalar;
+	__cpuid(info, 1);
+	if ((info[2] & (1 << 27)) == 0)   // OSXSAVE
+		return SimdLevel::Scalar;
+	unsigned long long xcr0 = _xgetbv(0);
+	__cpuidex(info, 7, 0);
+	if ((info[1] & (1 << 16)) != 0 && (xcr0 & 0xE6) == 0xE6)
+		return SimdLevel::Avx512;
+	if ((info[1] & (1 << 5)) != 0 && (xcr0 & 0x6) == 0x6)
+		return SimdLevel::Avx2;
+	return SimdLevel::Scalar;
+#else
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f"))
+		return SimdLevel::Avx512;
+	if (__builtin_cpu_supports("avx2"))
+		return SimdLevel::Avx2;
+	return SimdLevel::Scalar;
+#endif
+}
+#else
+static SimdLevel supportedLevel(void)
+{
+	return SimdLevel::Scalar;
+}
+#endif
+
+std::size_t FieldSize(FieldKind kind)
+{
+	switch (kind)
+	{
+	case FieldKind::Int8:
+	case FieldKind::UInt8:
+		return 1;
+	case FieldKind::Int16:
+	case FieldKind::UInt16:
+		return 2;
+	case FieldKind::Int32:
+	case FieldKind::UInt32:
+		return 4;
+	default:
+		return 8;
+	}
+}
+template <typename T>
+static long long valueAs(const char* field)
+{
+	T value;
+	memcpy(&value, field, sizeof(T));
+	return static_cast<long long>(value);
+}
+long long FieldValue(const char* field, FieldKind kind)
+{
+	switch (kind)
+	{
+	case FieldKind::Int8: return valueAs<signed char>(field);
+	case FieldKind::UInt8: return valueAs<unsigned char>(field);
+	case FieldKind::Int16: return valueAs<short>(field);
+	case FieldKind::UInt16: return valueAs<unsigned short>(field);
+	case FieldKind::Int32: return valueAs<int>(field);
+	case FieldKind::UInt32: return valueAs<unsigned int>(field);
+	case FieldKind::Int64: return valueAs<long long>(field);
+	default: return valueAs<unsigned long long>(field);
+	}
+}
+
+static const SimdLevel supported = supportedLevel();
+static std::atomic<SimdLevel> level{ supported };
+
+SimdLevel FilterLevel(void)
+{
+	return level;
+}
+void SetFilterLevel(SimdLevel wanted)
+{
+	level = static_cast<int>(wanted) <= static_cast<int>(supported) ? wanted : supported;
+}
+void FilterField(const char* field, std::size_t stride, std::size_t count,
+	FieldKind kind, Comp comp, long long key, unsigned long long* bits)
+{
+	std::size_t done = 0;
+#ifdef SYSCPPCP_X86
+	// Gather offsets are 32 bit
+	if (stride <= 0x7FFFFFFF / 16)
+	{
+		switch (level.load(std::memory_order_relaxed))
+		{
+		case SimdLevel::Avx512:
+			done = filterAvx512(field, stride, count, kind, comp, key, bits);
+			break;
+		case SimdLevel::Avx2:
+			done = filterAvx2(field, stride, count, kind, comp, key, bits);
+			break;
+		default:
+			break;
+		}
+	}
+#endif
+	filterScalar(field, stride, done, count, kind, comp, key, bits);
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <cstddef>
+#include "Record.h"
+
+// Comparison of one integer field over a block of records of one type.
+// Records of a type share their size and field offsets, so the field of
+// record i is at field + i * stride; the kernels load it for 8 or 16
+// records at once with AVX2 or AVX-512 gathers, and compare all of them
+// with one instruction. Used by SeekPlan::MatchBatch.
+
+// The integer type a field is compared in
+enum class FieldKind { Int8, UInt8, Int16, UInt16, Int32, UInt32, Int64, UInt64 };
+
+// Instruction set of the kernels; the best one the CPU supports is used
+enum class SimdLevel { Scalar, Avx2, Avx512 };
+
+// Sets bit i of bits for each of the count records whose field satisfies
+// "field comp key". bits holds (count + 63) / 64 words and is not cleared.
+// key is in the range of kind (for UInt64, the bits of the unsigned key).
+// Up to 3 bytes past a 1 or 2 byte field of the last record but one may be
+// read: a block of records of 4 bytes or more covers them, a column of
+// such fields needs 3 bytes of padding.
+void FilterField(const char* field, std::size_t stride, std::size_t count,
+	FieldKind kind, Comp comp, long long key, unsigned long long* bits);
+
+// Size of a field of kind, and its value (for UInt64, its bits)
+std::size_t FieldSize(FieldKind kind);
+long long FieldValue(const char* field, FieldKind kind);
+
+SimdLevel FilterLevel(void);
+// Lowers (or restores) the level used, for instance to compare the kernels;
+// a level the CPU lacks is not taken
+void SetFilterLevel(SimdLevel level);
@@ -0,0 +1,78 @@
+#include "ObjectCache.h"
+
+void ObjectCache::SetSize(std::size_t records)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	capacity = records;
+	Trim();
+}
+std::size_t ObjectCache::Size(void) const
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return capacity;
+}
+std::shared_ptr<Record> ObjectCache::Find(long long primaryKey)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	if (capacity == 0)
+		return nullptr;   // off: not counted
+	auto it = byKey.find(primaryKey);
+	if (it == byKey.end())
+	{
+		misses++;
+		return nullptr;
+	}
+	hits++;
+	entries.splice(entries.begin(), entries, it->second);
+	return it->second->second;
+}
+std::shared_ptr<Record> ObjectCache::Add(long long primaryKey, const std::shared_ptr<Record>& record)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	if (capacity == 0)
+		return record;
+	auto it = byKey.find(primaryKey);
+	if (it != byKey.end())
+	{
+		entries.splice(entries.begin(), entries, it->second);
+		return it->second->second;
+	}
+	entries.emplace_front(primaryKey, record);
+	byKey[primaryKey] = entries.begin();
+	Trim();
+	return record;
+}
+void ObjectCache::Remove(long long primaryKey)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	auto it = byKey.find(primaryKey);
+	if (it == byKey.end())
+		return;
+	entries.erase(it->second);
+	byKey.erase(it);
+}
+void ObjectCache::Clear(void)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	entries.clear();
+	byKey.clear();
+}
+// Callers holding an evicted record keep it alive through its shared_ptr
+void ObjectCache::Trim(void)
+{
+	while (entries.size() > capacity)
+	{
+		byKey.erase(entries.back().first);
+		entries.pop_back();
+	}
+}
+unsigned long long ObjectCache::Hits(void) const
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return hits;
+}
+unsigned long long ObjectCache::Misses(void) const
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return misses;
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+class Record;
+
+// Decoded records by primary key, shared between callers and bounded by a
+// record count, least recently used evicted first. Off (size 0) by default.
+class ObjectCache
+{
+public:
+	void SetSize(std::size_t records);
+	std::size_t Size(void) const;
+
+	std::shared_ptr<Record> Find(long long primaryKey);
+	// Caches record unless the key already has one, and returns the cached
+	// record, so that callers that missed together share one instance.
+	// While the cache is off it returns record.
+	std::shared_ptr<Record> Add(long long primaryKey, const std::shared_ptr<Record>& record);
+	// Called when the record is updated or deleted, or for all of them
+	void Remove(long long primaryKey);
+	void Clear(void);
+
+	unsigned long long Hits(void) const;
+	unsigned long long Misses(void) const;
+
+private:
+	typedef std::list<std::pair<long long, std::shared_ptr<Record>>> Entries;
+	void Trim(void);
+
+	std::size_t capacity = 0;
+	Entries entries;                                  // most recent first
+	std::unordered_map<long long, Entries::iterator> byKey;
+	unsigned long long hits = 0;
+	unsigned long long misses = 0;
+	mutable std::mutex lock;
+};
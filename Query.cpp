@@ -0,0 +1,93 @@
+#include "Database.h"
+#include "Record.h"
+#include "Query.h"
+#include <iostream>
+
+Query::Query(Record& record, const std::vector<recKey*>& keys) :
+	cursor(record, keys),
+	bodySize(record.GetDataSize() - sizeof(int) - REC_NAME_SIZE)
+{
+}
+Query& Query::Select(std::size_t offset, std::size_t size)
+{
+	if (size == 0 || offset + size > bodySize)
+	{
+		std::cout << "Column is outside the record." << std::endl;
+		return *this;
+	}
+	columns.push_back({ offset, size });
+	return *this;
+}
+Query& Query::Skip(std::size_t count)
+{
+	skip = count;
+	return *this;
+}
+Query& Query::Limit(std::size_t count)
+{
+	limit = count;
+	return *this;
+}
+const Query::Row& Query::Current(void) const
+{
+	return row;
+}
+Query::iterator Query::begin(void)
+{
+	return Next() == OpResult::True ? iterator(this) : end();
+}
+Query::iterator Query::end(void)
+{
+	return iterator(nullptr);
+}
+OpResult Query::Step(RecordView& view)
+{
+	// Past the window: stop before reading any more of the file
+	if (produced >= limit)
+		return OpResult::False;
+	for (; skipped < skip; skipped++)
+	{
+		OpResult ret = cursor.Next(view);
+		if (ret != OpResult::True)
+			return ret;
+	}
+	OpResult ret = cursor.Next(view);
+	if (ret == OpResult::True)
+		produced++;
+	return ret;
+}
+OpResult Query::Next(void)
+{
+	RecordView view;
+	OpResult ret = Step(view);
+	if (ret == OpResult::True)
+		row.Load(view, columns);
+	return ret;
+}
+std::size_t Query::Count(void)
+{
+	std::size_t count = 0;
+	RecordView view;
+	while (Step(view) == OpResult::True)
+		count++;
+	return count;
+}
+void Query::Row::Load(const RecordView& record, const std::vector<Query::Column>& selected)
+{
+	view = record;
+	columns = &selected;
+	if (starts.size() != selected.size())
+	{
+		starts.clear();
+		std::size_t size = 0;
+		for (const Query::Column& c : selected)
+		{
+			starts.push_back(size);
+			size += c.size;
+		}
+		values.resize(size);
+	}
+	const char* body = record.data + sizeof(int) + REC_NAME_SIZE;
+	for (std::size_t i = 0; i < selected.size(); i++)
+		memcpy(values.data() + starts[i], body + selected[i].offset, selected[i].size);
+}
@@ -0,0 +1,110 @@
+#pragma once
+#include <cstring>
+#include <string>
+#include <vector>
+#include "Cursor.h"
+
+// A lazy query over the records of one type: the matches of a list of
+// recKeys, optionally reduced to some of their fields (Select) and to a
+// window of the matches (Skip, Limit). Rows are produced as the range is
+// iterated and the file is not read past the last row of the window.
+//
+//	Person p;
+//	Query q(p, { &k1, &k2 });
+//	q.Select(8, sizeof(int)).Select(12, 16).Limit(50);
+//	for (const Query::Row& row : q)
+//		std::cout << row.Get<int>(0) << " " << row.GetString(1) << std::endl;
+//
+// Like a Cursor, the keys must outlive the query and the query must not
+// outlive the database.
+class Query
+{
+public:
+	// A field, located like a recKey (offset from the byte after RecName)
+	struct Column
+	{
+		std::size_t offset;
+		std::size_t size;
+	};
+
+	// One match: the selected columns, copied out of the record, and the
+	// record itself, valid until the query moves on
+	class Row
+	{
+	public:
+		std::size_t Columns(void) const { return columns == nullptr ? 0 : columns->size(); }
+		const char* Column(std::size_t i) const { return values.data() + starts[i]; }
+		template <typename T>
+		T Get(std::size_t i) const
+		{
+			T value;
+			memcpy(&value, Column(i), sizeof(T));
+			return value;
+		}
+		// A char array column, up to its first null
+		std::string GetString(std::size_t i) const
+		{
+			const char* s = Column(i);
+			return std::string(s, strnlen(s, (*columns)[i].size));
+		}
+		long long PrimaryKey(void) const { return view.PrimaryKey(); }
+		const RecordView& View(void) const { return view; }
+	private:
+		friend class Query;
+		void Load(const RecordView& record, const std::vector<Query::Column>& selected);
+
+		const std::vector<Query::Column>* columns = nullptr;
+		std::vector<std::size_t> starts;
+		std::vector<char> values;
+		RecordView view;
+	};
+
+	Query(Record& record, const std::vector<recKey*>& keys);
+
+	// Adds a column to the rows; without any, rows only carry the record
+	Query& Select(std::size_t offset, std::size_t size);
+	// Skips the first count matches
+	Query& Skip(std::size_t count);
+	// Stops after count rows
+	Query& Limit(std::size_t count);
+
+	// OpResult::True and the next row in Current(), False at the end of the
+	// window, Null on error
+	OpResult Next(void);
+	const Row& Current(void) const;
+	// Rows left in the window, counted without copying records
+	std::size_t Count(void);
+
+	class iterator
+	{
+	public:
+		explicit iterator(Query* query) : query(query) {}
+		const Row& operator*() const { return query->row; }
+		const Row* operator->() const { return &query->row; }
+		iterator& operator++()
+		{
+			if (query->Next() != OpResult::True)
+				query = nullptr;
+			return *this;
+		}
+		bool operator==(const iterator& other) const { return query == other.query; }
+		bool operator!=(const iterator& other) const { return query != other.query; }
+	private:
+		Query* query;   // nullptr: end
+	};
+	iterator begin(void);
+	iterator end(void);
+
+private:
+	// Moves to the next match inside the window
+	OpResult Step(RecordView& view);
+
+	Cursor cursor;
+	std::size_t bodySize;
+	std::vector<Column> columns;
+	std::size_t skip = 0;
+	std::size_t limit = static_cast<std::size_t>(-1);
+	std::size_t skipped = 0;
+	std::size_t produced = 0;
+	Row row;
+};
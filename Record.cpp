@@ -1,11 +1,18 @@
 #include "Database.h"
 #include "Record.h"
+#include "Storage.h"
+#include "SeekPlan.h"
+#include "Cursor.h"
+#include "Query.h"
 #include <cstdarg>  // For va_list, va_start, va_end
 #include <vector>
 #include <string>
 #include <algorithm>
 #include <cctype> // for std::tolower
-#include <chrono>
+#include <atomic>
+#include <functional>
+#include <future>
+#include <mutex>
 
 // Static function to access the record factory map with lazy initialization
 std::map<std::string, Record* (*)()>& Record::getRecordFactory() {
@@ -15,7 +22,9 @@ std::map<std::string, Record* (*)()>& Record::getRecordFactory() {
 }
 Database* nullDb = nullptr;  // Temporary placeholder for initialization
 Database* Record::db = nullDb;  // Will be properly initialized later
-long long Record::PrIdx = 0LL;
+thread_local long long Record::PrIdx = 0LL;
+// Derived constructors load from Record::db at PrIdx; PrIdx is per thread
+// so that records can be built on several threads at once
 
 struct HEADER
 {
@@ -26,18 +35,32 @@ struct HEADER
 
 Record::Record()
 {
-
+	database = nullptr;   // not bound: the database connected last is used
+	scanOffset = 0;
+	scanEpoch = 0;
 	recordDBAddress = std::streampos(-1);  // record was not saved to the db. Is is updated when 
 	// this record is insreted or retrieved from the database
 }
 Record::Record(const Record &other):
-	recordDBAddress(other.recordDBAddress)
+	recordDBAddress(other.recordDBAddress),
+	database(other.database),
+	scanOffset(other.scanOffset),
+	scanEpoch(other.scanEpoch)
 {
 }
 void Record::setDatabase(Database& dbm)
 {
 	Record::db = &dbm;
 }
+// Binds this record to a database, so that several can be open at once
+void Record::UseDatabase(Database& dbm)
+{
+	database = &dbm;
+}
+Database* Record::GetDatabase(void)
+{
+	return database != nullptr ? database : Record::db;
+}
 bool Record::IsSaved(void)
 {
 	if (recordDBAddress == std::streampos(-1))
@@ -48,13 +71,14 @@ bool Record::IsSaved(void)
 bool Record::IsDeleted(void)
 {
 	long long idx;
-	if (idx = GetPrimaryKey())
+	Database* db = GetDatabase();
+	if (db != nullptr && (idx = GetPrimaryKey()))
 	{
 		//check if this record is still in the database
-		if (GetRecordByIndex(idx))
-			return false;
-		else
-			return true;
+		Record* rec = GetRecordByIndex(*db, idx);
+		bool deleted = rec == nullptr;
+		delete rec;
+		return deleted;
 	}
 	else
 	{
@@ -63,7 +87,8 @@ bool Record::IsDeleted(void)
 }
 bool Record::Insert(void)
 {
-	if (Record::db == nullptr)
+	Database* db = GetDatabase();
+	if (db == nullptr)
 	{
 		std::cout << "Database is not opened." << std::endl;
 		return false;
@@ -73,22 +98,126 @@ bool Record::Insert(void)
 		std::cout << "Record name is invalid." << std::endl;
 		return false;
 	}
-	long long int tmp;
-	auto start = std::chrono::high_resolution_clock::now();
-	tmp = start.time_since_epoch().count();
-	tmp = (tmp - tmp / 1000000000000 * 1000000000000) / 100;
-	SetPrimaryKey(tmp);
-	// Save the current position to the record address
-	db->outFile.seekg(0, std::ios::end);
-	recordDBAddress = db->outFile.tellp();
+	Storage::Access access(Storage::Get(db), true);
+	SetPrimaryKey(Storage::Get(db).ReserveKeys(1));
+	// Reuse the slot of a deleted record of the same size, or append
+	std::streamoff slot;
+	if (Storage::Get(db).AllocateSlot(GetDataSize(), slot))
+		recordDBAddress = slot;
+	else
+	{
+		db->outFile.seekg(0, std::ios::end);
+		recordDBAddress = db->outFile.tellp();
+	}
+	Storage::Get(db).LogWrite(recordDBAddress, GetDataAddress(), GetDataSize());
+	db->outFile.seekp(recordDBAddress);
 	db->outFile.write(reinterpret_cast<char*>(GetDataAddress()), GetDataSize());
-	db->outFile.flush();
+	Storage::Get(db).Written();
+	Storage::Get(db).IndexRecord(GetPrimaryKey(), GetRecName(), recordDBAddress, GetDataSize());
+	Storage::Get(db).IndexFields(GetRecName(), recordDBAddress, GetDataAddress() + sizeof(int) + REC_NAME_SIZE, GetDataSize());
 
 	return true;
 }
+bool Record::InsertBatch(std::vector<Record*>& records)
+{
+	if (records.empty())
+		return true;
+	for (Record* rec : records)
+	{
+		if (rec == nullptr || !rec->GetRecName())
+		{
+			std::cout << "Record name is invalid." << std::endl;
+			return false;
+		}
+	}
+	// The whole batch goes to the database of its first record
+	Database* db = records.front()->GetDatabase();
+	if (db == nullptr || !db->IsOpen())
+	{
+		std::cout << "Database is not opened." << std::endl;
+		return false;
+	}
+	for (Record* rec : records)
+	{
+		if (rec->GetDatabase() != db)
+		{
+			std::cout << "Records of a batch must belong to one database." << std::endl;
+			return false;
+		}
+	}
+
+	Storage& storage = Storage::Get(db);
+	Storage::Access access(storage, true);
+	long long key = storage.ReserveKeys(records.size());
+
+	// Records are appended in chunks of about batchBytes, one write each
+	const std::size_t batchBytes = 4 * 1024 * 1024;
+	std::vector<char> buffer;
+	buffer.reserve(batchBytes);
+
+	db->outFile.seekg(0, std::ios::end);
+	std::streamoff offset = db->outFile.tellp();
+	std::streamoff chunkStart = offset;
+	auto writeChunk = [&]() -> bool
+	{
+		if (buffer.empty())
+			return true;
+		storage.LogWrite(chunkStart, buffer.data(), buffer.size());
+		db->outFile.seekp(chunkStart, std::ios::beg);
+		db->outFile.write(buffer.data(), buffer.size());
+		if (db->outFile.fail())
+		{
+			std::cerr << "Error: write() failed. Could not write " << buffer.size() << " bytes." << std::endl;
+			db->outFile.clear();
+			return false;
+		}
+		chunkStart += buffer.size();
+		buffer.clear();
+		return true;
+	};
+
+	std::size_t placed = 0;   // records given a key and an offset
+	bool written = true;
+	for (Record* rec : records)
+	{
+		rec->SetPrimaryKey(key++);
+		rec->recordDBAddress = offset;
+		placed++;
+		buffer.insert(buffer.end(), rec->GetDataAddress(), rec->GetDataAddress() + rec->GetDataSize());
+		offset += rec->GetDataSize();
+		if (buffer.size() >= batchBytes && !(written = writeChunk()))
+			break;
+	}
+	if (written)
+		written = writeChunk();
+	if (!written)
+	{
+		// The chunks written before the failure stay; the rest of the
+		// batch is cut off the file and its records are left unsaved
+		db->outFile.flush();
+		db->outFile.clear();
+		storage.Truncate(chunkStart);
+	}
+	storage.Written();
+
+	// Index maintenance is done once the records are on file
+	for (std::size_t i = 0; i < records.size(); i++)
+	{
+		Record* rec = records[i];
+		if (i >= placed || rec->recordDBAddress + static_cast<std::streamoff>(rec->GetDataSize()) > chunkStart)
+		{
+			rec->recordDBAddress = std::streampos(-1);
+			continue;
+		}
+		storage.IndexRecord(rec->GetPrimaryKey(), rec->GetRecName(), rec->recordDBAddress, rec->GetDataSize());
+		storage.IndexFields(rec->GetRecName(), rec->recordDBAddress, rec->GetDataAddress() + sizeof(int) + REC_NAME_SIZE, rec->GetDataSize());
+	}
+	return written;
+}
 bool Record::Update(void)
 {
-	if (Record::db == nullptr || !db->IsOpen()) {
+	Database* db = GetDatabase();
+	if (db == nullptr || !db->IsOpen()) {
 		std::cout << "Database is not opened." << std::endl;
 		return false;
 	}
@@ -97,10 +226,17 @@ bool Record::Update(void)
 		std::cout << "This instance of the class was not saved to the database." << std::endl;
 		return false;
 	}
+	Storage::Access access(Storage::Get(db), true);
 	if (IsDeleted()) {
 		std::cout << "This record was deleted." << std::endl;
 		return false;
 	}
+	// Records move when the file is compacted; the primary index has the
+	// current address
+	std::streamoff current;
+	if (Storage::Get(db).FindRecord(GetPrimaryKey(), current))
+		recordDBAddress = current;
+	Storage::Get(db).Objects().Remove(GetPrimaryKey());
 
 	if (!GetRecName()) {
 		std::cout << "Record name is invalid." << std::endl;
@@ -117,6 +253,7 @@ bool Record::Update(void)
 	}
 
 	// Seek to the previously saved record address and update
+	Storage::Get(db).LogWrite(recordDBAddress, GetDataAddress(), GetDataSize());
 	db->outFile.seekg(recordDBAddress);
 	if (db->outFile.fail()) {
 		std::cerr << "Error: seekg() failed. Could not move to position " << recordDBAddress << std::endl;
@@ -131,19 +268,22 @@ bool Record::Update(void)
 		return false;
 	}
 
-	// Flush the stream to ensure data is written to disk
-	db->outFile.flush();
+	// Flush the stream to ensure data is written to disk (at Commit
+	// inside a transaction)
+	Storage::Get(db).Written();
 	if (db->outFile.fail()) {
 		std::cerr << "Error: flush() failed." << std::endl;
 		return false;
 	}
+	Storage::Get(db).IndexFields(GetRecName(), recordDBAddress, GetDataAddress() + sizeof(int) + REC_NAME_SIZE, GetDataSize());
 
 	return true;
 }
 
 bool Record::Delete(void)
 {
-	if (Record::db == nullptr)
+	Database* db = GetDatabase();
+	if (db == nullptr)
 	{
 		std::cout << "Database is not opened." << std::endl;
 		return false;
@@ -154,11 +294,21 @@ bool Record::Delete(void)
 		std::cout << "This record was not saved to the database." << std::endl;
 		return false;
 	}
+	Storage::Access access(Storage::Get(db), true);
 	if (IsDeleted())
 	{
 		std::cout << "This record has already been deleted." << std::endl;
 		return false;
 	}
+	// Records move when the file is compacted; the primary index has the
+	// current address
+	std::streamoff current;
+	if (Storage::Get(db).FindRecord(GetPrimaryKey(), current))
+		recordDBAddress = current;
+	Storage::Get(db).UnindexRecord(GetPrimaryKey());
+	Storage::Get(db).Objects().Remove(GetPrimaryKey());
+	Storage::Get(db).UnindexFields(GetRecName(), recordDBAddress);
+	std::string recName = GetRecName();   // cleared below
 	void* dataAddress = GetDataAddress();
 
 	// Adjust the address by sizeof(int)  bytes
@@ -172,63 +322,52 @@ bool Record::Delete(void)
 
 	// Write n null bytes to the file
 	std::vector<char> nullBytes(GetDataSize() - sizeof(int), '\0'); // Create a vector with 'n' null bytes
+	Storage::Get(db).LogWrite(recordDBAddress + static_cast<std::streamoff>(sizeof(int)), nullBytes.data(), GetDataSize() - sizeof(int));
 	db->outFile.seekg(recordDBAddress + static_cast<std::streamoff>(sizeof(int)));
 	db->outFile.write(nullBytes.data(), GetDataSize() - sizeof(int));   // Write the entire buffer to the file
-	db->outFile.flush();
+	Storage::Get(db).Written();
+	Storage::Get(db).FreeSlot(GetDataSize(), recordDBAddress, recName.c_str());
 
 	//recordDBAddress = std::streampos(-1);
 
 	return true;
 }
-OpResult  Record::GetRecordByName(void)
+// Insert, Update and Delete on the database's writer thread. The writes run
+// in the order they were queued and the future holds their result; the
+// record must stay alive and unchanged until it is ready.
+static std::future<bool> queueWrite(Database* db, std::function<bool()> op)
 {
-	OpResult ret = OpResult::False;
-	HEADER header;
-	char* buffer = NULL;
-	std::uint32_t  bufferSize = 0;
-
-	while (true)
+	if (db == nullptr)
 	{
-		recordDBAddress = db->outFile.tellp();
-		db->outFile.read((char*)(&header), sizeof(HEADER));
-
-		if (db->outFile.gcount() != sizeof(HEADER) || header.RecSize == 0)
-		{
-			db->outFile.clear();
-			ret = OpResult::False;
-			break;
-		}
-		if (strcmp(header.RecName, GetRecName()) == 0)
-		{
-			buffer = new char[header.RecSize];
-			bufferSize = header.RecSize;
-
-			db->outFile.read(buffer, header.RecSize - sizeof(HEADER));
-			if (db->outFile.gcount() != header.RecSize - sizeof(HEADER))
-			{
-				delete[] buffer;
-				return OpResult::False;
-			}
-			memcpy((void*)(GetDataAddress()), &header, sizeof(HEADER));
-			memcpy((void*)(GetDataAddress() + sizeof(HEADER)), buffer, header.RecSize - sizeof(HEADER));
-			ret = OpResult::True;
-			break;
-		}
-		else
-		{
-			db->outFile.seekp(header.RecSize - sizeof(HEADER), std::ios::cur);
-			continue;
-		}
-
+		std::cout << "Database is not opened." << std::endl;
+		std::promise<bool> failed;
+		failed.set_value(false);
+		return failed.get_future();
 	}
-
-
-
-	return ret;
+	return Storage::Get(db).IO().QueueWrite(op);
+}
+std::future<bool> Record::InsertAsync(void)
+{
+	return queueWrite(GetDatabase(), [this]() { return Insert(); });
+}
+std::future<bool> Record::UpdateAsync(void)
+{
+	return queueWrite(GetDatabase(), [this]() { return Update(); });
+}
+std::future<bool> Record::DeleteAsync(void)
+{
+	return queueWrite(GetDatabase(), [this]() { return Delete(); });
+}
+OpResult  Record::GetRecordByName(void)
+{
+	// No keys: every record of this type matches
+	std::vector<recKey*> keys;
+	return SeekFrom(scanOffset, keys);
 }
 OpResult Record::Seek(recKey* k1, ...)
 {
-	if (Record::db == nullptr)
+	Database* db = GetDatabase();
+	if (db == nullptr)
 	{
 		std::cout << "Database is not opened." << std::endl;
 		return OpResult::Null;
@@ -239,127 +378,26 @@ OpResult Record::Seek(recKey* k1, ...)
 		std::cout << "Database is not opened." << std::endl;
 		return OpResult::Null;
 	}
-	// Start processing variable arguments
-	va_list args;
-	va_start(args, k1); // Initialize args to store all values after k2
-
-	db->outFile.seekg(0, std::ios::beg);
+	scanOffset = 0;
 
 	if (!k1)
 		return GetRecordByName();
 
+	std::vector<recKey*> keys;
+	keys.push_back(k1);
+	va_list args;
+	va_start(args, k1); // Initialize args to store all values after k1
+	for (recKey* key = va_arg(args, recKey*); key != nullptr; key = va_arg(args, recKey*))
+		keys.push_back(key);
+	va_end(args);
 
-	char buff[sizeof(int) + REC_NAME_SIZE];
-	char recName[REC_NAME_SIZE];
-	char* buffer = NULL;
-	std::uint32_t  bufferSize = 0;
-	int recSz = 0;
-	db->outFile.seekg(0, std::ios::beg);
-	while (true)
-	{
-		LastOpResult = OpResult::Null;
-		LastAndOr = AndOr::Null;
-
-		db->outFile.read(buff, sizeof(int) + REC_NAME_SIZE);
-		if (db->outFile.gcount() != sizeof(int) + REC_NAME_SIZE)
-		{
-			db->outFile.clear();
-			return OpResult::False;
-		}
-
-		std::memcpy(&recSz, buff, sizeof(recSz));
-		std::memcpy(recName, buff + sizeof(int), REC_NAME_SIZE);
-		if (strcmp(recName, GetRecName()) != 0)
-		{
-			db->outFile.seekg(recSz - sizeof(int) - REC_NAME_SIZE, std::ios::cur);
-			continue;
-		}
-		if (bufferSize < recSz)
-		{
-			delete[] buffer;
-			buffer = new char[recSz];
-			bufferSize = recSz;
-		}
-		db->outFile.read(buffer, recSz - sizeof(int) - REC_NAME_SIZE);
-		if (db->outFile.gcount() != recSz - sizeof(int) - REC_NAME_SIZE)
-		{
-			delete[] buffer;
-			return OpResult::False;
-		}
-
-		va_list args;
-		va_start(args, k1); // Initialize args to store all values after k2
-		// Example processing of the first two fixed arguments
-		if (k1)
-		{
-			try {
-				LastOpResult = processSeek(k1, buffer);
-			}
-			catch (const std::invalid_argument& e) {
-				std::cerr << "Invalid argument: " << e.what() << std::endl;
-				delete[] buffer;
-				return OpResult::Null;
-			}
-			catch (const std::out_of_range& e) {
-				std::cerr << "Out of range: " << e.what() << std::endl;
-				delete[] buffer;
-				return OpResult::Null;
-			}
-		}
-		else
-		{
-			std::cout << "Invalid search." << std::endl;
-			delete[] buffer;
-			return OpResult::Null;;
-		}
-
-		// Example processing of additional arguments
-		recKey* key = nullptr;
-		// Process additional arguments
-		while (true) {
-			key = va_arg(args, recKey*);
-			if (key == nullptr) {
-				break;  // Exit the loop if no more arguments
-			}
-
-			try {
-				LastOpResult = processSeek(key, buffer);
-			}
-			catch (const std::invalid_argument& e) {
-				std::cerr << "Invalid argument: " << e.what() << std::endl;
-				delete[] buffer;
-				va_end(args);  // Clean up the argument list
-				return OpResult::Null;
-			}
-			catch (const std::out_of_range& e) {
-				std::cerr << "Out of range: " << e.what() << std::endl;
-				delete[] buffer;
-				va_end(args);  // Clean up the argument list
-				return OpResult::Null;
-			}
-		}
-
-		va_end(args);  // Clean up the argument list after processing all arguments
-
-		if (LastOpResult == OpResult::True)
-		{
-			memcpy((void*)(GetDataAddress() + sizeof(int) + REC_NAME_SIZE), buffer, recSz - sizeof(int) - REC_NAME_SIZE);
-
-			db->outFile.seekg(-recSz, std::ios::cur);
-			recordDBAddress = db->outFile.tellp();
-			db->outFile.seekg(recSz, std::ios::cur);
-
-			delete[] buffer;
-			return LastOpResult;
-		}
-	}
-	delete[] buffer;
-	return LastOpResult;
+	return SeekFrom(0, keys);
 }
 
 OpResult Record::Next(recKey* k1, ...)
 {
-	if (Record::db == nullptr)
+	Database* db = GetDatabase();
+	if (db == nullptr)
 	{
 		std::cout << "Database is not opened." << std::endl;
 		return OpResult::Null;
@@ -370,119 +408,246 @@ OpResult Record::Next(recKey* k1, ...)
 		std::cout << "Database is not opened." << std::endl;
 		return OpResult::Null;
 	}
-	// Start processing variable arguments
-	va_list args;
-	va_start(args, k1); // Initialize args to store all values after k2
 
 	if (!k1)
 		return GetRecordByName();
 
+	std::vector<recKey*> keys;
+	keys.push_back(k1);
+	va_list args;
+	va_start(args, k1); // Initialize args to store all values after k1
+	for (recKey* key = va_arg(args, recKey*); key != nullptr; key = va_arg(args, recKey*))
+		keys.push_back(key);
+	va_end(args);
 
-	char buff[sizeof(int) + REC_NAME_SIZE];
-	char recName[REC_NAME_SIZE];
-	char* buffer = NULL;
-	std::uint32_t  bufferSize = 0;
-	int recSz = 0;
-	while (true)
+	return SeekFrom(scanOffset, keys);
+}
+bool Record::CreateIndex(recKey* k)
+{
+	Database* db = GetDatabase();
+	if (db == nullptr || !db->IsOpen())
 	{
-		LastOpResult = OpResult::Null;
-		LastAndOr = AndOr::Null;
-
-		db->outFile.read(buff, sizeof(int) + REC_NAME_SIZE);
-		if (db->outFile.gcount() != sizeof(int) + REC_NAME_SIZE)
-		{
-			db->outFile.clear();
-			return OpResult::False;
-		}
-
-		std::memcpy(&recSz, buff, sizeof(recSz));
-		std::memcpy(recName, buff + sizeof(int), REC_NAME_SIZE);
-		if (strcmp(recName, GetRecName()) != 0)
-		{
-			db->outFile.seekg(recSz - sizeof(int) - REC_NAME_SIZE, std::ios::cur);
-			continue;
-		}
-		if (bufferSize < recSz)
-		{
-			delete[] buffer;
-			buffer = new char[recSz];
-			bufferSize = recSz;
-		}
-		db->outFile.read(buffer, recSz - sizeof(int) - REC_NAME_SIZE);
-		if (db->outFile.gcount() != recSz - sizeof(int) - REC_NAME_SIZE)
-		{
-			delete[] buffer;
-			return OpResult::False;
-		}
+		std::cout << "Database is not opened." << std::endl;
+		return false;
+	}
+	if (!GetRecName())
+	{
+		std::cout << "Record name is invalid." << std::endl;
+		return false;
+	}
+	if (!Storage::IsIndexable(k))
+	{
+		std::cout << "'" << k->typeInfo.name() << "' fields can not be indexed." << std::endl;
+		return false;
+	}
+	Storage::Access access(Storage::Get(db), true);
+	return Storage::Get(db).AddFieldIndex(GetRecName(), k);
+}
+// Finds every record of this type matching the keys, like a Seek/Next
+// loop, but splits the file into chunks that are scanned on several
+// threads. A new record is appended to results for every match, in file
+// order; the caller deletes them.
+OpResult Record::SeekAll(std::vector<Record*>& results, recKey* k1, ...)
+{
+	Database* db = GetDatabase();
+	if (db == nullptr || !db->IsOpen())
+	{
+		std::cout << "Database is not opened." << std::endl;
+		return OpResult::Null;
+	}
+	if (!GetRecName())
+	{
+		std::cout << "Record name is invalid." << std::endl;
+		return OpResult::Null;
+	}
+	auto factory = getRecordFactory().find(GetRecName());
+	if (factory == getRecordFactory().end())
+	{
+		std::cout << "'" << GetRecName() << "' is not registered." << std::endl;
+		return OpResult::Null;
+	}
 
-		va_list args;
-		va_start(args, k1); // Initialize args to store all values after k2
-		// Example processing of the first two fixed arguments
-		if (k1)
+	std::vector<recKey*> keys;
+	va_list args;
+	va_start(args, k1);
+	for (recKey* key = k1; key != nullptr; key = va_arg(args, recKey*))
+		keys.push_back(key);
+	va_end(args);
+
+	Storage& storage = Storage::Get(db);
+	Storage::Access access(storage, false);
+	SeekPlan plan;
+	plan.Compile(keys, [this](std::string name) { return GetEnumValue(name); });
+
+	const std::size_t chunkBytes = 1024 * 1024;
+	auto chunks = storage.ScanChunks(GetRecName(), GetDataSize(), chunkBytes);
+	std::vector<std::vector<Record*>> found(chunks.size());
+	std::atomic<std::size_t> next{ 0 };
+	std::atomic<bool> failed{ false };
+	const char* recName = GetRecName();
+	const int dataSize = GetDataSize();
+	const bool batched = plan.Batchable();
+	std::vector<const Storage::ZoneMap*> zoneMaps;
+	storage.ZoneMaps(GetRecName(), plan, zoneMaps);
+	const bool zoned = std::any_of(zoneMaps.begin(), zoneMaps.end(), [](const Storage::ZoneMap* m) { return m != nullptr; });
+
+	// Workers take the next chunk until there are none left, so a slow
+	// chunk does not hold the others back
+	auto worker = [&]()
+	{
+		SeekPlan local = plan;   // terms keep per-scan buffers
+		std::vector<unsigned long long> selection;
+		char name[REC_NAME_SIZE];
+		int recSz;
+		auto add = [&](std::size_t c, std::streamoff offset, int size, const char* buffer)
 		{
-			try {
-				LastOpResult = processSeek(k1, buffer);
-			}
-			catch (const std::invalid_argument& e) {
-				std::cerr << "Invalid argument: " << e.what() << std::endl;
-				delete[] buffer;
-				return OpResult::Null;
-			}
-			catch (const std::out_of_range& e) {
-				std::cerr << "Out of range: " << e.what() << std::endl;
-				delete[] buffer;
-				return OpResult::Null;
-			}
-		}
-		else
+			PrIdx = 0;   // built empty; the match is copied in
+			Record* rec = factory->second();
+			memcpy((void*)(rec->GetDataAddress() + sizeof(int) + REC_NAME_SIZE), buffer, size - sizeof(int) - REC_NAME_SIZE);
+			rec->recordDBAddress = offset;
+			rec->UseDatabase(*db);
+			found[c].push_back(rec);
+		};
+		for (std::size_t c = next++; c < chunks.size() && !failed; c = next++)
 		{
-			std::cout << "Invalid search." << std::endl;
-			delete[] buffer;
-			return OpResult::Null;;
-		}
-
-		// Example processing of additional arguments
-		recKey* key = nullptr;
-		// Process additional arguments
-		while (true) {
-			key = va_arg(args, recKey*);
-			if (key == nullptr) {
-				break;  // Exit the loop if no more arguments
-			}
-
-			try {
-				LastOpResult = processSeek(key, buffer);
-			}
-			catch (const std::invalid_argument& e) {
-				std::cerr << "Invalid argument: " << e.what() << std::endl;
-				delete[] buffer;
-				va_end(args);  // Clean up the argument list
-				return OpResult::Null;
-			}
-			catch (const std::out_of_range& e) {
-				std::cerr << "Out of range: " << e.what() << std::endl;
-				delete[] buffer;
-				va_end(args);  // Clean up the argument list
-				return OpResult::Null;
+			std::streamoff zoneBlock = -1;
+			for (std::streamoff offset = chunks[c].first; offset < chunks[c].second; offset += recSz)
+			{
+				// Blocks whose zones rule the keys out are stepped over
+				if (zoned && offset / static_cast<std::streamoff>(Storage::ZoneBytes) != zoneBlock)
+				{
+					std::streamoff end;
+					zoneBlock = offset / static_cast<std::streamoff>(Storage::ZoneBytes);
+					if (!Storage::BlockMayMatch(plan, zoneMaps, offset, end))
+					{
+						recSz = static_cast<int>(end - offset);
+						continue;
+					}
+				}
+				// Integer keys are evaluated for a block of records at a
+				// time, up to the first of another size
+				std::size_t rows = 0;
+				const char* block = nullptr;
+				if (batched)
+				{
+					rows = std::min<std::size_t>(SeekPlan::BlockRows,
+						static_cast<std::size_t>((chunks[c].second - offset) / dataSize));
+					while (rows >= SeekPlan::MinBlockRows && (block = storage.View(offset, rows * dataSize)) == nullptr)
+						rows /= 2;
+				}
+				if (block != nullptr)
+				{
+					for (std::size_t i = 0; i < rows; i++)
+					{
+						std::memcpy(&recSz, block + i * dataSize, sizeof(recSz));
+						if (recSz != dataSize)
+						{
+							rows = i;
+							break;
+						}
+					}
+				}
+				if (block != nullptr && rows > 0)
+				{
+					local.MatchBatch(block + sizeof(int) + REC_NAME_SIZE, dataSize, rows, selection);
+					for (std::size_t i = 0; i < rows; i++)
+					{
+						const char* rec = block + i * dataSize;
+						if (SeekPlan::Selected(selection, i) && strncmp(rec + sizeof(int), recName, REC_NAME_SIZE) == 0)
+							add(c, offset + static_cast<std::streamoff>(i * dataSize), dataSize, rec + sizeof(int) + REC_NAME_SIZE);
+					}
+					recSz = static_cast<int>(rows * dataSize);   // past the block
+					continue;
+				}
+
+				const char* buff = storage.View(offset, sizeof(int) + REC_NAME_SIZE);
+				if (buff == nullptr)
+					break;
+				std::memcpy(&recSz, buff, sizeof(recSz));
+				std::memcpy(name, buff + sizeof(int), REC_NAME_SIZE);
+				if (recSz <= 0)
+					break;
+				if (strcmp(name, recName) != 0)
+					continue;
+				const char* buffer = storage.View(offset + sizeof(int) + REC_NAME_SIZE, recSz - sizeof(int) - REC_NAME_SIZE);
+				if (buffer == nullptr)
+					break;
+				OpResult ret;
+				try {
+					ret = keys.empty() ? OpResult::True : local.Match(buffer);
+				}
+				catch (const std::invalid_argument& e) {
+					std::cerr << "Invalid argument: " << e.what() << std::endl;
+					failed = true;
+					return;
+				}
+				catch (const std::out_of_range& e) {
+					std::cerr << "Out of range: " << e.what() << std::endl;
+					failed = true;
+					return;
+				}
+				if (ret == OpResult::True)
+					add(c, offset, recSz, buffer);
 			}
 		}
+	};
+	std::vector<std::future<void>> workers;
+	unsigned int threads = std::min<std::size_t>(storage.ScanThreads(), chunks.size());
+	for (unsigned int t = 1; t < threads; t++)
+		workers.push_back(std::async(std::launch::async, worker));
+	worker();
+	for (auto& w : workers)
+		w.wait();
 
-		va_end(args);  // Clean up the argument list after processing all arguments
-
-		if (LastOpResult == OpResult::True)
+	OpResult ret = OpResult::False;
+	for (auto& chunk : found)
+	{
+		for (Record* rec : chunk)
 		{
-			memcpy((void*)(GetDataAddress() + sizeof(int) + REC_NAME_SIZE), buffer, recSz - sizeof(int) - REC_NAME_SIZE);
-
-			db->outFile.seekg(-recSz, std::ios::cur);
-			recordDBAddress = db->outFile.tellp();
-			db->outFile.seekg(recSz, std::ios::cur);
-
-			delete[] buffer;
-			return LastOpResult;
+			if (failed)
+				delete rec;
+			else
+			{
+				results.push_back(rec);
+				ret = OpResult::True;
+			}
 		}
 	}
-	delete[] buffer;
-	return LastOpResult;
+	return failed ? OpResult::Null : ret;
+}
+// Seek and Next are a cursor opened for one step at the record's scan offset
+OpResult Record::SeekFrom(std::streamoff offset, std::vector<recKey*>& keys)
+{
+	Cursor cursor(*this, keys, offset);
+	if (offset != 0)
+		cursor.Continue(scanEpoch, GetPrimaryKey());
+	OpResult ret = cursor.Next();
+	scanOffset = cursor.Offset();
+	scanEpoch = cursor.Epoch();
+	return ret;
+}
+// Opens a cursor over the records of this type that match the keys; it
+// loads them into this record as it advances
+Cursor Record::Scan(recKey* k1, ...)
+{
+	std::vector<recKey*> keys;
+	va_list args;
+	va_start(args, k1);
+	for (recKey* key = k1; key != nullptr; key = va_arg(args, recKey*))
+		keys.push_back(key);
+	va_end(args);
+	return Cursor(*this, keys);
+}
+// A lazy query over the matches of the keys, see Query
+Query Record::Where(recKey* k1, ...)
+{
+	std::vector<recKey*> keys;
+	va_list args;
+	va_start(args, k1);
+	for (recKey* key = k1; key != nullptr; key = va_arg(args, recKey*))
+		keys.push_back(key);
+	va_end(args);
+	return Query(*this, keys);
 }
 OpResult Record::processSeek(recKey* k, const  char* buff)
 {
@@ -889,51 +1054,198 @@ OpResult Record::processSeek(recKey* k, const  char* buff)
 	return LastOpResult;
 }
 Record* Record::GetRecordByIndex(long long prIdx) {
+	if (Record::db == nullptr)
+	{
+		std::cout << "Database was not created in the application." << std::endl;
+		return nullptr;
+	}
+	return GetRecordByIndex(*Record::db, prIdx);
+}
+Record* Record::GetRecordByIndex(Database& dbm, long long prIdx) {
 	Record* newRecord = nullptr;
+	Storage& storage = Storage::Get(&dbm);
+	Storage::Access access(storage, false);
+	// GetRecordName leaves the stream at the record for the constructor
+	std::lock_guard<std::recursive_mutex> stream(storage.StreamLock());
 
-	std::string className = GetRecordName(prIdx);
+	std::string className = GetRecordName(dbm, prIdx);
 	if (className.empty())
 	{
 		return nullptr;
 	}
-	PrIdx = prIdx;
 	// Use the getRecordFactory() function to access the map
 	if (getRecordFactory().find(className) != getRecordFactory().end())
 	{
+		// A new record loads itself from the default database. For another
+		// one it is built empty and the record copied in from dbm, so that
+		// Record::db is never changed under other threads.
+		const bool loads = Record::db == &dbm;
+		PrIdx = loads ? prIdx : 0;
 		newRecord = getRecordFactory()[className]();
+		if (!loads)
+		{
+			const std::size_t header = sizeof(int) + REC_NAME_SIZE;
+			std::streamoff offset;
+			const char* rec = nullptr;
+			int recSz = 0;
+			if (storage.FindRecord(prIdx, offset))
+				rec = storage.View(offset, newRecord->GetDataSize());
+			if (rec != nullptr)
+				memcpy(&recSz, rec, sizeof(recSz));
+			if (recSz != newRecord->GetDataSize())
+			{
+				delete newRecord;
+				return nullptr;
+			}
+			memcpy((void*)(newRecord->GetDataAddress() + header), rec + header, recSz - header);
+			newRecord->recordDBAddress = offset;
+		}
+		newRecord->UseDatabase(dbm);
 	}
 
 	return newRecord;
 }
-std::string Record::GetRecordName(long long prIdx)
+// GetRecordByIndex for many keys at once: records[i] is the record of
+// keys[i], or nullptr if there is none. The records are read in file
+// order; without the mapping the pages of each window of records are
+// loaded into the buffer pool with one batch of reads.
+bool Record::GetRecordsByIndex(Database& dbm, const std::vector<long long>& keys, std::vector<Record*>& records)
 {
-	if (Record::db == nullptr)
-	{
-		std::cout << "Database was not created in the application." << std::endl;
-		return nullptr;
-	}
-	if (!db->IsOpen())
+	records.assign(keys.size(), nullptr);
+	if (!dbm.IsOpen())
 	{
 		std::cout << "Database is not opened." << std::endl;
-		return nullptr;
+		return false;
+	}
+	Storage& storage = Storage::Get(&dbm);
+	Storage::Access access(storage, false);
 
+	std::vector<std::pair<std::streamoff, std::size_t>> order;   // offset, index in keys
+	order.reserve(keys.size());
+	for (std::size_t i = 0; i < keys.size(); i++)
+	{
+		std::streamoff offset;
+		if (storage.FindRecord(keys[i], offset))
+			order.emplace_back(offset, i);
 	}
-	HEADER header;
-	db->outFile.seekg(0, std::ios::beg);
-	while (true)
+	std::sort(order.begin(), order.end());
+
+	const std::size_t header = sizeof(int) + REC_NAME_SIZE;
+	const std::size_t windowPages = 64;
+	char name[REC_NAME_SIZE];
+	int recSz;
+	std::size_t next = 0;
+	while (next < order.size())
 	{
-		db->outFile.read((char*)(&header), sizeof(HEADER));
-		if (db->outFile.gcount() != sizeof(HEADER) || header.RecSize == 0)
+		std::size_t end = order.size();
+		if (!storage.IsMemoryMapped())
 		{
-			db->outFile.clear();
-			return "";
+			std::vector<std::streamoff> pages;
+			for (end = next; end < order.size(); end++)
+			{
+				std::streamoff page = order[end].first - order[end].first % static_cast<std::streamoff>(BufferPool::PageSize);
+				if (pages.empty() || pages.back() != page)
+				{
+					if (pages.size() == windowPages)
+						break;
+					pages.push_back(page);
+				}
+			}
+			storage.Pool().Prefetch(pages);
 		}
-		if (header.primaryKey == prIdx)
+		for (; next < end; next++)
 		{
-			return header.RecName;
+			std::streamoff offset = order[next].first;
+			const char* buff = storage.View(offset, header);
+			if (buff == nullptr)
+				continue;
+			std::memcpy(&recSz, buff, sizeof(recSz));
+			std::memcpy(name, buff + sizeof(int), REC_NAME_SIZE);
+			if (recSz < static_cast<int>(header) || name[0] == '\0')
+				continue;
+			auto factory = getRecordFactory().find(name);
+			if (factory == getRecordFactory().end())
+				continue;
+			const char* rec = storage.View(offset, recSz);
+			if (rec == nullptr)
+				continue;
+			PrIdx = 0;   // built empty; the record is copied in
+			Record* newRecord = factory->second();
+			if (newRecord->GetDataSize() != recSz)
+			{
+				delete newRecord;
+				continue;
+			}
+			memcpy((void*)(newRecord->GetDataAddress() + header), rec + header, recSz - header);
+			newRecord->recordDBAddress = offset;
+			newRecord->UseDatabase(dbm);
+			records[order[next].second] = newRecord;
 		}
-		db->outFile.seekg(header.RecSize - sizeof(HEADER), std::ios::cur);
+	}
+	return true;
+}
+// Like GetRecordByIndex, but the record is shared: while the database's
+// object cache is on (Database::SetObjectCacheSize), callers asking for the
+// same key get the same instance until it is updated, deleted or evicted.
+// Treat it as read only; Update/Delete through a copy or a record of your
+// own.
+std::shared_ptr<Record> Record::GetSharedRecord(long long prIdx)
+{
+	if (Record::db == nullptr)
+	{
+		std::cout << "Database was not created in the application." << std::endl;
+		return nullptr;
+	}
+	return GetSharedRecord(*Record::db, prIdx);
+}
+std::shared_ptr<Record> Record::GetSharedRecord(Database& dbm, long long prIdx)
+{
+	Storage& storage = Storage::Get(&dbm);
+	Storage::Access access(storage, false);
+	std::shared_ptr<Record> rec = storage.Objects().Find(prIdx);
+	if (rec)
+		return rec;
+	rec.reset(GetRecordByIndex(dbm, prIdx));
+	if (rec)
+		rec = storage.Objects().Add(prIdx, rec);   // another caller may have loaded it first
+	return rec;
+}
+std::string Record::GetRecordName(long long prIdx)
+{
+	if (Record::db == nullptr)
+	{
+		std::cout << "Database was not created in the application." << std::endl;
+		return "";
+	}
+	return GetRecordName(*Record::db, prIdx);
+}
+std::string Record::GetRecordName(Database& dbm, long long prIdx)
+{
+	Database* db = &dbm;
+	if (!db->IsOpen())
+	{
+		std::cout << "Database is not opened." << std::endl;
+		return "";
 
 	}
+	Storage& storage = Storage::Get(db);
+	Storage::Access access(storage, false);
+	std::lock_guard<std::recursive_mutex> stream(storage.StreamLock());
+	HEADER header;
+	std::streamoff offset;
+	if (!storage.FindRecord(prIdx, offset))
+		return "";
+
+	// Leave the stream just past the header, where a full scan would stop
+	db->outFile.clear();
+	db->outFile.seekg(offset, std::ios::beg);
+	db->outFile.read((char*)(&header), sizeof(HEADER));
+	if (db->outFile.gcount() == sizeof(HEADER) && header.primaryKey == prIdx)
+		return header.RecName;
+	db->outFile.clear();
+
+	// The writes keep the index in step with the file and a stale one is
+	// rebuilt at Connect; it can not be rebuilt under a shared Access
+	std::cerr << "Error: the index does not match " << db->GetDatabaseName() << std::endl;
 	return "";
 }
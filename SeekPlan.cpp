@@ -0,0 +1,491 @@
+#include "SeekPlan.h"
+#include <algorithm>
+#include <cctype> // for std::tolower
+#include <climits>
+#include <cstring>
+#include <iostream>
+#include <type_traits>
+
+typedef bool (*TermTest)(SeekPlan::Term& t, const char* buff);
+
+template <typename T>
+static T fieldAs(const char* p)
+{
+	T val;
+	memcpy(&val, p, sizeof(T));
+	return val;
+}
+
+// Readers return the field value and the constant in the types that
+// processSeek compares them in
+template <typename T>
+struct ReadInt
+{
+	static long long value(SeekPlan::Term& t, const char* buff) { return fieldAs<T>(buff + t.offset); }
+	static long long key(SeekPlan::Term& t) { return t.key; }
+};
+struct ReadULongLong
+{
+	static unsigned long long value(SeekPlan::Term& t, const char* buff) { return fieldAs<unsigned long long>(buff + t.offset); }
+	static unsigned long long key(SeekPlan::Term& t) { return t.ukey; }
+};
+struct ReadChar
+{
+	static long long value(SeekPlan::Term& t, const char* buff) { return (buff + t.offset)[0]; }
+	static long long key(SeekPlan::Term& t) { return t.key; }
+};
+struct ReadEnum
+{
+	static unsigned int value(SeekPlan::Term& t, const char* buff) { return fieldAs<unsigned int>(buff + t.offset); }
+	static unsigned int key(SeekPlan::Term& t) { return static_cast<unsigned int>(t.key); }
+};
+struct ReadText
+{
+	static const std::string& value(SeekPlan::Term& t, const char* buff)
+	{
+		const char* field = buff + t.offset;
+		t.scratch.assign(field, strnlen(field, t.sz));
+		t.scratch.erase(std::remove(t.scratch.begin(), t.scratch.end(), ' '), t.scratch.end());
+		return t.scratch;
+	}
+	static const std::string& key(SeekPlan::Term& t) { return t.text; }
+};
+
+template <typename Read, typename Op>
+static bool testTerm(SeekPlan::Term& t, const char* buff)
+{
+	return Op()(Read::value(t, buff), Read::key(t));
+}
+template <typename Read>
+static TermTest resolve(Comp comp)
+{
+	switch (comp)
+	{
+	case Comp::Equal:
+		return testTerm<Read, std::equal_to<>>;
+	case Comp::NotEqual:
+		return testTerm<Read, std::not_equal_to<>>;
+	case Comp::Greater:
+		return testTerm<Read, std::greater<>>;
+	case Comp::Smaller:
+		return testTerm<Read, std::less<>>;
+	case Comp::GreaterEq:
+		return testTerm<Read, std::greater_equal<>>;
+	case Comp::SmallerEq:
+		return testTerm<Read, std::less_equal<>>;
+	default:
+		std::cout << "Invalid operator." << std::endl;
+		return nullptr;
+	}
+}
+
+const std::size_t SeekPlan::BlockRows;
+const std::size_t SeekPlan::MinBlockRows;
+
+// The kind of a field of integer type T
+template <typename T>
+static FieldKind kindOf(void)
+{
+	if (sizeof(T) == 1)
+		return std::is_signed<T>::value ? FieldKind::Int8 : FieldKind::UInt8;
+	if (sizeof(T) == 2)
+		return std::is_signed<T>::value ? FieldKind::Int16 : FieldKind::UInt16;
+	if (sizeof(T) == 4)
+		return std::is_signed<T>::value ? FieldKind::Int32 : FieldKind::UInt32;
+	return std::is_signed<T>::value ? FieldKind::Int64 : FieldKind::UInt64;
+}
+static bool isEnum(const std::type_info& type)
+{
+	return type.name()[0] == 'e' &&
+		type.name()[1] == 'n' &&
+		type.name()[2] == 'u' &&
+		type.name()[3] == 'm';
+}
+bool SeekPlan::KindOf(const std::type_info& type, FieldKind& kind)
+{
+	if (type == typeid(bool) ||
+		type == typeid(char) ||
+		type == typeid(signed char) ||
+		type == typeid(unsigned char))
+		kind = kindOf<char>();   // processSeek reads them as char
+	else if (type == typeid(signed short int))
+		kind = kindOf<signed short int>();
+	else if (type == typeid(unsigned short int))
+		kind = kindOf<unsigned short int>();
+	else if (type == typeid(signed  int))
+		kind = kindOf<signed  int>();
+	else if (type == typeid(unsigned  int) || isEnum(type))
+		kind = kindOf<unsigned  int>();
+	else if (type == typeid(signed long int))
+		kind = kindOf<signed long int>();
+	else if (type == typeid(unsigned long int))
+		// Read into a long long, so an unsigned long of 8 bytes compares as signed
+		kind = sizeof(unsigned long int) == sizeof(long long) ? FieldKind::Int64 : kindOf<unsigned long int>();
+	else if (type == typeid(signed long long int))
+		kind = FieldKind::Int64;
+	else if (type == typeid(unsigned long long int))
+		kind = FieldKind::UInt64;
+	else
+		return false;
+	return true;
+}
+// Values a field of kind holds; UInt64 keys are their bits, never out of range
+static void rangeOf(FieldKind kind, long long& lo, long long& hi)
+{
+	switch (kind)
+	{
+	case FieldKind::Int8: lo = SCHAR_MIN; hi = SCHAR_MAX; break;
+	case FieldKind::UInt8: lo = 0; hi = UCHAR_MAX; break;
+	case FieldKind::Int16: lo = SHRT_MIN; hi = SHRT_MAX; break;
+	case FieldKind::UInt16: lo = 0; hi = USHRT_MAX; break;
+	case FieldKind::Int32: lo = INT_MIN; hi = INT_MAX; break;
+	case FieldKind::UInt32: lo = 0; hi = UINT_MAX; break;
+	default: lo = LLONG_MIN; hi = LLONG_MAX; break;
+	}
+}
+// Records the comparison of t for FilterField
+static void vectorize(SeekPlan::Term& t, FieldKind kind, Comp comp)
+{
+	if (t.test == nullptr || t.error)
+		return;
+	long long lo, hi;
+	rangeOf(kind, lo, hi);
+	t.vectorized = true;
+	t.kind = kind;
+	t.vcomp = comp;
+	t.vkey = t.key;
+	// A constant outside the range gives the same result for every record
+	if (t.key < lo)
+		t.constant = comp == Comp::Greater || comp == Comp::GreaterEq || comp == Comp::NotEqual;
+	else if (t.key > hi)
+		t.constant = comp == Comp::Smaller || comp == Comp::SmallerEq || comp == Comp::NotEqual;
+}
+
+void SeekPlan::Compile(const std::vector<recKey*>& keys, const std::function<unsigned int(std::string)>& enumValue)
+{
+	terms.clear();
+	batchable = false;
+	for (recKey* k : keys)
+	{
+		Term t{ k->andOr, k->offset, k->sz, 0, 0, "", "", false, nullptr, nullptr };
+		const std::type_info& type = k->typeInfo;
+		Comp comp = k->comp;   // as the field is compared
+
+		if (type == typeid(bool))
+		{
+			std::string value = k->value;
+			std::transform(value.begin(), value.end(), value.begin(),
+				[](unsigned char c) { return std::tolower(c); });
+			if (value == "true" || value == "1")
+				t.key = 1;
+			else if (value == "false" || value == "0")
+				t.key = 0;
+			else
+				t.key = LLONG_MIN;  // matches no field byte
+			if (k->comp == Comp::Equal || k->comp == Comp::NotEqual)
+				t.test = resolve<ReadChar>(k->comp);
+			else
+				std::cout << "'Greater than' and 'Smaller than' operators does not apply to bool type." << std::endl;
+		}
+		else if (type == typeid(char) ||
+			type == typeid(signed char) ||
+			type == typeid(unsigned char))
+		{
+			// processSeek compares chars as "key comp value"
+			t.key = k->value.c_str()[0];
+			if (comp == Comp::Greater) comp = Comp::Smaller;
+			else if (comp == Comp::Smaller) comp = Comp::Greater;
+			else if (comp == Comp::GreaterEq) comp = Comp::SmallerEq;
+			else if (comp == Comp::SmallerEq) comp = Comp::GreaterEq;
+			t.test = resolve<ReadChar>(comp);
+		}
+		else if (type == typeid(signed short int) ||
+			type == typeid(signed  int) ||
+			type == typeid(signed long int) ||
+			type == typeid(signed long long int) ||
+			type == typeid(unsigned short int) ||
+			type == typeid(unsigned  int) ||
+			type == typeid(unsigned long int) ||
+			type == typeid(unsigned long long int))
+		{
+			try {
+				t.key = std::stoll(k->value);
+				t.ukey = t.key;
+			}
+			catch (...) {
+				t.error = std::current_exception();
+			}
+			if (type == typeid(signed short int))
+				t.test = resolve<ReadInt<signed short int>>(k->comp);
+			else if (type == typeid(signed  int))
+				t.test = resolve<ReadInt<signed  int>>(k->comp);
+			else if (type == typeid(signed long int))
+				t.test = resolve<ReadInt<signed long int>>(k->comp);
+			else if (type == typeid(signed long long int))
+				t.test = resolve<ReadInt<signed long long int>>(k->comp);
+			else if (type == typeid(unsigned short int))
+				t.test = resolve<ReadInt<unsigned short int>>(k->comp);
+			else if (type == typeid(unsigned  int))
+				t.test = resolve<ReadInt<unsigned  int>>(k->comp);
+			else if (type == typeid(unsigned long int))
+				t.test = resolve<ReadInt<unsigned long int>>(k->comp);
+			else
+				t.test = resolve<ReadULongLong>(k->comp);
+		}
+		else if (type.name()[0] == 'c' &&
+			type.name()[1] == 'h' &&
+			type.name()[2] == 'a' &&
+			type.name()[3] == 'r' &&
+			type.name()[5] == '[')
+		{
+			t.text = k->value;
+			t.text.erase(std::remove(t.text.begin(), t.text.end(), ' '), t.text.end());
+			t.test = resolve<ReadText>(k->comp);
+		}
+		else if (isEnum(type))
+		{
+			std::string tmp = type.name();
+			tmp.replace(tmp.find("enum "), 5, "");
+			tmp += "::" + k->value;
+			unsigned int key = enumValue(tmp);
+			if (key == static_cast<unsigned int>(-1))
+				t.skip = true;
+			t.key = key;
+			t.test = resolve<ReadEnum>(k->comp);
+		}
+		else
+		{
+			std::cout << "'" << type.name() << "' is not supported." << std::endl;
+		}
+		FieldKind kind;
+		if (KindOf(type, kind))
+			vectorize(t, kind, comp);
+		terms.push_back(t);
+	}
+	batchable = !terms.empty();
+	for (const Term& t : terms)
+	{
+		if (!t.vectorized || t.skip)
+			batchable = false;
+	}
+}
+OpResult SeekPlan::Match(const char* buff)
+{
+	OpResult result = OpResult::Null;
+	AndOr lastAndOr = AndOr::Null;
+	for (Term& t : terms)
+	{
+		if (result != OpResult::Null)
+		{
+			// Short circuit, left to right: "x OR ..." is true, "x AND ..." is false
+			if (result == OpResult::True && lastAndOr == AndOr::Or)
+			{
+				lastAndOr = t.andOr;
+				continue;
+			}
+			if (result != OpResult::True && lastAndOr == AndOr::And)
+			{
+				lastAndOr = t.andOr;
+				continue;
+			}
+		}
+		if (t.error)
+			std::rethrow_exception(t.error);
+		if (t.skip)
+			continue;
+		if (t.test)
+			result = t.test(t, buff) ? OpResult::True : OpResult::False;
+		lastAndOr = t.andOr;
+	}
+	return result;
+}
+bool SeekPlan::Batchable(void) const
+{
+	return batchable;
+}
+void SeekPlan::MatchBatch(const char* body, std::size_t stride, std::size_t count,
+	std::vector<unsigned long long>& selection)
+{
+	if (!batchable)
+	{
+		selection.assign((count + 63) / 64, 0);
+		for (std::size_t i = 0; i < count; i++)
+		{
+			if (Match(body + i * stride) == OpResult::True)
+				selection[i / 64] |= 1ULL << (i % 64);
+		}
+		return;
+	}
+	std::vector<const char*> fields;
+	std::vector<std::size_t> strides(terms.size(), stride);
+	for (const Term& t : terms)
+		fields.push_back(body + t.offset);
+	Filter(fields, strides, count, selection);
+}
+void SeekPlan::MatchColumns(const std::vector<const char*>& fields, const std::vector<std::size_t>& strides,
+	std::size_t count, std::vector<unsigned long long>& selection)
+{
+	if (batchable)
+	{
+		Filter(fields, strides, count, selection);
+		return;
+	}
+	// Lays the fields of each record out as Match expects them
+	std::size_t size = 0;
+	for (const Term& t : terms)
+		size = std::max(size, t.offset + t.sz);
+	std::vector<char> row(std::max<std::size_t>(size, sizeof(long long)));
+	selection.assign((count + 63) / 64, 0);
+	for (std::size_t i = 0; i < count; i++)
+	{
+		for (std::size_t j = 0; j < terms.size(); j++)
+			memcpy(row.data() + terms[j].offset, fields[j] + i * strides[j], terms[j].sz);
+		if (Match(row.data()) == OpResult::True)
+			selection[i / 64] |= 1ULL << (i % 64);
+	}
+}
+void SeekPlan::Filter(const std::vector<const char*>& fields, const std::vector<std::size_t>& strides,
+	std::size_t count, std::vector<unsigned long long>& selection)
+{
+	const std::size_t words = (count + 63) / 64;
+	selection.assign(words, 0);
+
+	// Match without its short circuit: a term joined by OR to the result
+	// so far is ORed into it, by AND ANDed, and without one replaces it
+	for (std::size_t j = 0; j < terms.size(); j++)
+	{
+		Term& t = terms[j];
+		std::vector<unsigned long long>& bits = j == 0 ? selection : termBits;
+		if (j != 0)
+			bits.assign(words, 0);
+		if (t.constant == 1)
+		{
+			for (std::size_t w = 0; w < words; w++)
+				bits[w] = ~0ULL;
+			if (count % 64 != 0)
+				bits[words - 1] = (1ULL << (count % 64)) - 1;
+		}
+		else if (t.constant == -1)
+			FilterField(fields[j], strides[j], count, t.kind, t.vcomp, t.vkey, bits.data());
+		if (j == 0)
+			continue;
+
+		AndOr andOr = terms[j - 1].andOr;
+		for (std::size_t w = 0; w < words; w++)
+		{
+			if (andOr == AndOr::Or)
+				selection[w] |= bits[w];
+			else if (andOr == AndOr::And)
+				selection[w] &= bits[w];
+			else
+				selection[w] = bits[w];
+		}
+	}
+}
+const std::vector<SeekPlan::Term>& SeekPlan::Terms(void) const
+{
+	return terms;
+}
+
+void SeekPlan::Zone::Add(const char* field)
+{
+	long long value = FieldValue(field, kind);
+	if (empty)
+	{
+		min = max = value;
+		empty = false;
+	}
+	else if (kind == FieldKind::UInt64)
+	{
+		if (static_cast<unsigned long long>(value) < static_cast<unsigned long long>(min))
+			min = value;
+		if (static_cast<unsigned long long>(value) > static_cast<unsigned long long>(max))
+			max = value;
+	}
+	else
+	{
+		min = std::min(min, value);
+		max = std::max(max, value);
+	}
+}
+// What a term gives for the records of a zone: true for all, false for
+// all, or either
+enum class ZoneResult { True, False, Either };
+
+static ZoneResult overZone(const SeekPlan::Term& t, const SeekPlan::Zone* zone)
+{
+	if (t.constant != -1)
+		return t.constant ? ZoneResult::True : ZoneResult::False;
+	if (zone == nullptr || zone->empty || zone->kind != t.kind)
+		return ZoneResult::Either;
+	auto less = [&t](long long a, long long b)
+	{
+		if (t.kind == FieldKind::UInt64)
+			return static_cast<unsigned long long>(a) < static_cast<unsigned long long>(b);
+		return a < b;
+	};
+	const long long key = t.vkey;
+	bool all, none;
+	switch (t.vcomp)
+	{
+	case Comp::Equal:
+	case Comp::NotEqual:
+		none = less(key, zone->min) || less(zone->max, key);
+		all = zone->min == key && zone->max == key;
+		if (t.vcomp == Comp::NotEqual)
+			std::swap(all, none);
+		break;
+	case Comp::Greater:
+		none = !less(key, zone->max);
+		all = less(key, zone->min);
+		break;
+	case Comp::Smaller:
+		none = !less(zone->min, key);
+		all = less(zone->max, key);
+		break;
+	case Comp::GreaterEq:
+		none = less(zone->max, key);
+		all = !less(zone->min, key);
+		break;
+	case Comp::SmallerEq:
+		none = less(key, zone->min);
+		all = !less(key, zone->max);
+		break;
+	default:
+		return ZoneResult::Either;
+	}
+	return none ? ZoneResult::False : all ? ZoneResult::True : ZoneResult::Either;
+}
+bool SeekPlan::MayMatch(const std::function<const Zone*(const Term& t)>& zoneOf) const
+{
+	if (terms.empty())
+		return true;
+	ZoneResult result = ZoneResult::Either;
+	for (std::size_t j = 0; j < terms.size(); j++)
+	{
+		const Term& t = terms[j];
+		// Keys the zones cannot answer exactly as Match would, and
+		// constants Match reports, leave the records to it
+		if (t.error || t.skip || t.test == nullptr)
+			return true;
+		ZoneResult r = t.vectorized ? overZone(t, zoneOf(t)) : ZoneResult::Either;
+		AndOr andOr = j == 0 ? AndOr::Null : terms[j - 1].andOr;
+		if (andOr == AndOr::Or)
+		{
+			if (result == ZoneResult::True || r == ZoneResult::True)
+				result = ZoneResult::True;
+			else if (result != r)
+				result = ZoneResult::Either;
+		}
+		else if (andOr == AndOr::And)
+		{
+			if (result == ZoneResult::False || r == ZoneResult::False)
+				result = ZoneResult::False;
+			else if (result != r)
+				result = ZoneResult::Either;
+		}
+		else
+			result = r;
+	}
+	return result != ZoneResult::False;
+}
@@ -0,0 +1,98 @@
+#pragma once
+#include <exception>
+#include <functional>
+#include <string>
+#include <typeinfo>
+#include <vector>
+#include "Record.h"
+#include "FilterKernel.h"
+
+// A list of recKeys compiled once per Seek/Next. Constants are parsed and
+// every key is resolved to a typed comparator up front, so evaluating a
+// record only runs the comparators. The result is the same as calling
+// Record::processSeek for each key in order, including its left to right
+// AND/OR short circuit.
+class SeekPlan
+{
+public:
+	// enumValue resolves "Type::Value" the way Record::GetEnumValue does
+	void Compile(const std::vector<recKey*>& keys, const std::function<unsigned int(std::string)>& enumValue);
+	// buff points just past the record name, as recKey offsets expect.
+	// Throws std::invalid_argument/std::out_of_range for constants that
+	// could not be parsed, like processSeek.
+	OpResult Match(const char* buff);
+
+	// True when every key compares an integer field (or a bool, char or enum)
+	// with a constant, so MatchBatch evaluates a whole block with the
+	// vector kernels
+	bool Batchable(void) const;
+	// Evaluates count records of one size laid out back to back; body
+	// points just past the name of the first one. Sets bit i of selection
+	// when Match would return True for record i. Not batchable plans run
+	// Match on each record and throw like it.
+	void MatchBatch(const char* body, std::size_t stride, std::size_t count,
+		std::vector<unsigned long long>& selection);
+	// Same over columns: fields[j] holds the field of key j for each of
+	// the count records, strides[j] bytes apart
+	void MatchColumns(const std::vector<const char*>& fields, const std::vector<std::size_t>& strides,
+		std::size_t count, std::vector<unsigned long long>& selection);
+	static bool Selected(const std::vector<unsigned long long>& selection, std::size_t row)
+	{
+		return (selection[row / 64] >> (row % 64) & 1) != 0;
+	}
+	// Records per block, and the fewest worth a block
+	static const std::size_t BlockRows = 256;
+	static const std::size_t MinBlockRows = 16;
+
+	// The kind a key on a field of type is compared in; false for types
+	// that are not compared as integers (char[], float...)
+	static bool KindOf(const std::type_info& type, FieldKind& kind);
+
+	// The min and max of a field over a block of records, in the order of
+	// kind (UInt64 values as their bits)
+	struct Zone
+	{
+		FieldKind kind = FieldKind::Int64;
+		bool empty = true;
+		long long min = 0;
+		long long max = 0;
+		// Widens the zone to the value of field
+		void Add(const char* field);
+	};
+
+	struct Term
+	{
+		AndOr andOr;
+		std::size_t offset;
+		std::size_t sz;
+		long long key;
+		unsigned long long ukey;
+		std::string text;
+		std::string scratch;         // per term buffer for char[] fields
+		bool skip;                   // enum value not found: leaves the result as is
+		bool (*test)(Term& t, const char* buff);  // nullptr: no comparison for this key
+		std::exception_ptr error;    // constant failed to parse
+
+		// The comparison as FilterField runs it. A constant outside the
+		// range of the field gives the same result for every record:
+		// constant is then 1 or 0, otherwise -1.
+		bool vectorized = false;
+		FieldKind kind = FieldKind::Int32;
+		Comp vcomp = Comp::Equal;
+		long long vkey = 0;
+		int constant = -1;
+	};
+
+	// False when no record whose fields lie in their zones can match.
+	// zoneOf returns the zone of a key's field, nullptr if there is none.
+	bool MayMatch(const std::function<const Zone*(const Term& t)>& zoneOf) const;
+	const std::vector<Term>& Terms(void) const;
+
+private:
+	void Filter(const std::vector<const char*>& fields, const std::vector<std::size_t>& strides,
+		std::size_t count, std::vector<unsigned long long>& selection);
+
+	std::vector<Term> terms;
+	bool batchable = false;
+	std::vector<unsigned long long> termBits;
+};
@@ -0,0 +1,1763 @@
+#include "Database.h"
+#include "Record.h"
+#include "Storage.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <thread>
+
+#pragma pack(push, 1)  // Aligns members on 1-byte boundaries
+struct HEADER
+{
+	int RecSize;
+	char RecName[REC_NAME_SIZE];
+	long long int primaryKey;
+};
+// First bytes of the index file: metadata of the data file, so that opening
+// a database or counting its records does not scan it
+struct SUPERBLOCK
+{
+	char Magic[8];
+	long long int Version;    // format of the index file
+	long long int DataSize;   // size of the data file when the index was saved
+	long long int Records;    // records in the data file, deleted ones included
+	long long int HighWater;  // primary key high-water mark
+	long long int Types;      // TYPECOUNT entries following the superblock
+	long long int IndexRoot;  // offset of the primary index in the index file
+	long long int Count;      // entries of the primary index
+	long long int Dirty;      // the data file was written after the index was saved
+};
+struct TYPECOUNT
+{
+	char RecName[REC_NAME_SIZE];
+	long long int Live;
+	long long int Deleted;
+};
+struct INDEXENTRY
+{
+	long long int primaryKey;
+	long long int offset;
+};
+struct FREESLOT
+{
+	long long int Size;
+	long long int Offset;
+	char RecName[REC_NAME_SIZE];   // type of the deleted record; empty if unknown
+};
+struct LOGENTRY
+{
+	int Type;
+	long long int Offset;
+	long long int Size;    // bytes of image following the entry
+};
+struct EXTENTHEADER
+{
+	char RecName[REC_NAME_SIZE];
+	long long int Count;
+};
+struct EXTENTENTRY
+{
+	long long int start;
+	long long int end;
+};
+struct ZONEHEADER
+{
+	char RecName[REC_NAME_SIZE];
+	long long int Offset;   // of the field, as in a recKey
+	int Kind;
+	long long int Blocks;
+};
+struct ZONEENTRY
+{
+	int Empty;
+	long long int Min;
+	long long int Max;
+	long long int End;
+};
+#pragma pack(pop)  // Restores the previous packing alignment
+
+enum LogEntryType { LOG_BEGIN = 1, LOG_UNDO, LOG_REDO, LOG_COMMIT, LOG_ROLLBACK };
+
+static const char indexMagic[8] = { 'S', 'Y', 'S', 'P', 'I', 'D', 'X', 'S' };
+static const long long int indexVersion = 7;
+// Keys reserved ahead in the superblock, so that not every Insert syncs it
+static const long long int keyLeaseSize = 4096;
+
+Storage::Storage(void) :
+	pool([this](std::streamoff offset, char* dest, std::size_t n) { return ReadFile(offset, dest, n); },
+		[this](std::vector<AsyncIO::Request>& requests) { ReadFileBatch(requests); })
+{
+}
+static std::map<const Database*, Storage>& instances()
+{
+	static std::map<const Database*, Storage> storages;
+	return storages;
+}
+static std::mutex& instancesLock()
+{
+	static std::mutex lock;
+	return lock;
+}
+Storage& Storage::Get(const Database* db)
+{
+	std::lock_guard<std::mutex> lock(instancesLock());
+	return instances()[db];
+}
+void Storage::Release(const Database* db)
+{
+	Storage* storage;
+	{
+		std::lock_guard<std::mutex> lock(instancesLock());
+		auto it = instances().find(db);
+		if (it == instances().end())
+			return;
+		storage = &it->second;
+	}
+	// Queued writes take the lock, and look their Storage up
+	storage->IO().Drain();
+	// Operations look their Storage up while holding its lock
+	{
+		Access access(*storage, true);
+		storage->Close();
+	}
+	std::lock_guard<std::mutex> lock(instancesLock());
+	instances().erase(db);
+}
+// Storages whose lock this thread holds, and how
+static thread_local std::vector<std::pair<const Storage*, bool>> held;
+
+Storage::Access::Access(Storage& s, bool excl) : storage(&s), exclusive(excl)
+{
+	for (const auto& h : held)
+	{
+		if (h.first == storage)
+		{
+			storage = nullptr;
+			return;
+		}
+	}
+	if (exclusive)
+	{
+		storage->accessLock.lock();
+		// No reader is left that could use a replaced mapping
+		storage->Reclaim();
+	}
+	else
+		storage->accessLock.lock_shared();
+	held.emplace_back(storage, exclusive);
+}
+Storage::Access::~Access()
+{
+	if (storage == nullptr)
+		return;
+	for (auto it = held.begin(); it != held.end(); ++it)
+	{
+		if (it->first == storage)
+		{
+			held.erase(it);
+			break;
+		}
+	}
+	if (exclusive)
+		storage->accessLock.unlock();
+	else
+		storage->accessLock.unlock_shared();
+}
+std::recursive_mutex& Storage::StreamLock(void)
+{
+	return streamLock;
+}
+void Storage::Open(std::fstream& dataFile, const std::string& fileName)
+{
+	file = &dataFile;
+	dataFileName = fileName;
+	indexFileName = dataFileName + ".idx";
+	logFileName = dataFileName + ".wal";
+	inTransaction = false;
+	unflushed = false;
+	undo.clear();
+	pool.Clear();
+	objects.Clear();
+	version++;
+	if (memoryMapped)
+		Remap();
+	primaryIndex.clear();
+	extents.clear();
+	freeSlots.clear();
+	slotTypes.clear();
+	typeCounts.clear();
+	zoneMaps.clear();
+	zonesChanged = false;
+	recordCount = 0;
+	dataEnd = 0;
+	indexDirty = false;
+	indexMarked = false;
+	keyHighWater = 0;
+	keyLease = 0;
+	markedLease = 0;
+
+	// The index is trusted only if it was saved by a Close after the last
+	// write, against a data file of the same size; otherwise (crash, file
+	// edited elsewhere) rebuild it.
+	bool recovered = OpenLog() && Recover();
+	if (recovered || !LoadIndex())
+		RebuildIndex();
+	for (auto& index : fieldIndexes)
+		BuildFieldIndex(index);
+}
+void Storage::Close(void)
+{
+	if (file == nullptr)
+		return;
+	if (inTransaction)
+	{
+		std::cout << "Uncommitted transaction was rolled back." << std::endl;
+		Rollback();
+	}
+	WaitCheckpoint();
+	if (logFd != -1)
+	{
+		file->flush();
+		Checkpoint();
+		::close(logFd);
+		logFd = -1;
+	}
+	SaveIndex();
+	Unmap();
+	pool.Clear();
+	objects.Clear();
+	file = nullptr;
+}
+bool Storage::FindRecord(long long primaryKey, std::streamoff& offset) const
+{
+	auto it = primaryIndex.find(primaryKey);
+	if (it == primaryIndex.end())
+		return false;
+	offset = it->second;
+	return true;
+}
+void Storage::IndexRecord(long long primaryKey, const char* recName, std::streamoff offset, int recSize)
+{
+	AddToExtent(recName, offset, recSize);
+	indexDirty = true;
+	if (offset >= dataEnd)
+	{
+		recordCount++;   // appended, not in a slot that was counted already
+		dataEnd = offset + recSize;
+	}
+	if (!primaryKey)
+		return;
+	CountType(recName, 1, 0);
+	primaryIndex.emplace(primaryKey, offset);  // first record with a key wins, as in a file scan
+	std::lock_guard<std::mutex> lock(keyLock);
+	keyHighWater = std::max(keyHighWater, primaryKey);
+}
+void Storage::FreeSlot(int recSize, std::streamoff offset, const char* recName)
+{
+	freeSlots[recSize].push_back(offset);
+	slotTypes[offset] = recName;
+	CountType(recName, -1, 1);
+	indexDirty = true;
+}
+bool Storage::AllocateSlot(int recSize, std::streamoff& offset)
+{
+	auto sizeClass = freeSlots.find(recSize);
+	if (sizeClass == freeSlots.end() || sizeClass->second.empty())
+		return false;
+	offset = sizeClass->second.back();
+	sizeClass->second.pop_back();
+	if (sizeClass->second.empty())
+		freeSlots.erase(sizeClass);
+	// The type stays known for the slot, in case a rollback frees it again;
+	// RebuildIndex drops the types of slots that are not free
+	auto type = slotTypes.find(offset);
+	CountType(type != slotTypes.end() ? type->second : "", 0, -1);
+	indexDirty = true;
+	return true;
+}
+void Storage::CountType(const std::string& recName, long long live, long long deleted)
+{
+	TypeCount& count = typeCounts[recName];
+	count.live += live;
+	count.deleted += deleted;
+	if (count.live == 0 && count.deleted == 0)
+		typeCounts.erase(recName);
+}
+long long Storage::RecordCount(void) const
+{
+	return recordCount;
+}
+long long Storage::LiveCount(const std::string& recName) const
+{
+	auto it = typeCounts.find(recName);
+	return it == typeCounts.end() ? 0 : it->second.live;
+}
+void Storage::LiveCounts(std::map<std::string, long>& counts) const
+{
+	counts.clear();
+	for (const auto& it : typeCounts)
+	{
+		if (it.second.live != 0)
+			counts[it.first] = static_cast<long>(it.second.live);
+	}
+}
+void Storage::DeletedCounts(std::map<std::string, long>& counts) const
+{
+	counts.clear();
+	for (const auto& it : typeCounts)
+	{
+		if (it.second.deleted != 0)
+			counts[it.first] = static_cast<long>(it.second.deleted);
+	}
+}
+// Readers go on while the live records are copied: the copy is made under
+// a shared Access, and the exclusive one is only taken to swap the files
+// and reload the index. A write between the two makes the copy stale; it
+// is then made again, and the last attempt keeps writers out throughout.
+long long Storage::Compact(void)
+{
+	for (const auto& h : held)
+	{
+		if (h.first == this)
+		{
+			std::cout << "Can not compact inside another operation on the database." << std::endl;
+			return -1;
+		}
+	}
+	std::lock_guard<std::mutex> compacting(compactLock);
+	const std::string compactFileName = dataFileName + ".compact";
+	const int attempts = 3;
+	for (int attempt = 0; attempt < attempts; attempt++)
+	{
+		std::unique_ptr<Access> writers;
+		if (attempt == attempts - 1)
+			writers.reset(new Access(*this, true));
+		unsigned long long copied;
+		{
+			Access access(*this, false);
+			if (file == nullptr || !file->is_open())
+				return -1;
+			if (inTransaction)
+			{
+				std::cout << "Can not compact while a transaction is active." << std::endl;
+				return -1;
+			}
+			copied = version;
+			// The log refers to offsets in the old file; it has to be empty
+			// at the swap. Syncing the data file here keeps that out of the
+			// exclusive lock.
+			WaitCheckpoint();
+			Checkpoint();
+			if (!CopyLive(compactFileName))
+				return -1;
+		}
+
+		Access access(*this, true);
+		if (file == nullptr || !file->is_open() || version != copied || inTransaction)
+		{
+			remove(compactFileName.c_str());
+			if (file == nullptr || !file->is_open())
+				return -1;
+			continue;   // written since the copy
+		}
+		WaitCheckpoint();
+		bool logged;
+		{
+			std::lock_guard<std::mutex> lock(logLock);
+			logged = logSize != 0;
+		}
+		if (logged)
+		{
+			file->flush();
+			Checkpoint();
+			std::lock_guard<std::mutex> lock(logLock);
+			logged = logSize != 0;
+		}
+		if (logged)
+		{
+			std::cerr << "Error: could not checkpoint " << logFileName << std::endl;
+			remove(compactFileName.c_str());
+			return -1;
+		}
+		std::streamoff oldSize = DataFileSize();
+
+		// Swap the files; until the rename the old file is untouched
+		{
+			std::lock_guard<std::mutex> lock(keyLock);
+			MarkIndex();
+		}
+		// The stream is swapped rather than closed and reopened: callers
+		// check IsOpen before they take the Access
+		std::fstream compacted(compactFileName, std::ios::in | std::ios::out | std::ios::binary);
+		bool replaced = compacted.is_open() && rename(compactFileName.c_str(), dataFileName.c_str()) == 0;
+		if (!replaced)
+		{
+			std::cerr << "Error: could not replace " << dataFileName << std::endl;
+			remove(compactFileName.c_str());
+			return -1;   // the old file, and its index, are still in use
+		}
+		Unmap();
+		file->flush();
+		file->swap(compacted);
+		compacted.close();
+		if (memoryMapped)
+			Remap();
+
+		// Offsets taken before the swap no longer point at the same records
+		epoch++;
+		RebuildIndex();
+		for (auto& index : fieldIndexes)
+			BuildFieldIndex(index);
+		return oldSize - DataFileSize();
+	}
+	return -1;
+}
+// Writes the live records into fileName, grouped by record type and in
+// file order within a type, and syncs it. Called with a shared Access.
+bool Storage::CopyLive(const std::string& fileName)
+{
+	// One pass collects the live records of each type, in file order
+	std::map<std::string, std::vector<std::streamoff>> live;
+	HEADER header;
+	std::streamoff offset = 0;
+	while (true)
+	{
+		const char* rec = View(offset, sizeof(HEADER));
+		if (rec == nullptr)
+			break;
+		memcpy(&header, rec, sizeof(HEADER));
+		if (header.RecSize == 0)
+			break;
+		if (header.primaryKey)
+			live[header.RecName].push_back(offset);
+		offset += header.RecSize;
+	}
+
+	std::ofstream out(fileName, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!out)
+	{
+		std::cerr << "Error: could not create " << fileName << std::endl;
+		return false;
+	}
+	for (const auto& type : live)
+	{
+		for (std::streamoff at : type.second)
+		{
+			const char* rec = View(at, sizeof(HEADER));
+			if (rec == nullptr)
+				break;
+			memcpy(&header, rec, sizeof(HEADER));
+			rec = View(at, header.RecSize);
+			if (rec == nullptr)
+				break;
+			out.write(rec, header.RecSize);
+		}
+	}
+	out.close();
+	if (out.fail())
+	{
+		std::cerr << "Error: could not write " << fileName << std::endl;
+		remove(fileName.c_str());
+		return false;
+	}
+	int fd = ::open(fileName.c_str(), O_RDONLY);
+	if (fd == -1 || fsync(fd) != 0)
+	{
+		if (fd != -1)
+			::close(fd);
+		std::cerr << "Error: could not sync " << fileName << std::endl;
+		remove(fileName.c_str());
+		return false;
+	}
+	::close(fd);
+	return true;
+}
+unsigned long long Storage::Epoch(void) const
+{
+	return epoch;
+}
+long long Storage::ReserveKeys(long long count)
+{
+	std::lock_guard<std::mutex> lock(keyLock);
+	long long first = keyHighWater + 1;
+	keyHighWater += count;
+	indexDirty = true;
+	// The superblock holds a mark above every key handed out, so that keys
+	// are not handed out twice after a crash
+	if (keyHighWater > keyLease)
+	{
+		keyLease = keyHighWater + keyLeaseSize;
+		MarkIndex();
+	}
+	return first;
+}
+void Storage::AddToExtent(const char* recName, std::streamoff offset, int recSize)
+{
+	if (recName == nullptr || recName[0] == '\0')
+		return;
+	std::vector<Extent>& runs = extents[recName];
+	std::streamoff end = offset + recSize;
+	auto next = std::upper_bound(runs.begin(), runs.end(), offset,
+		[](std::streamoff value, const Extent& e) { return value < e.start; });
+	if (next != runs.begin() && std::prev(next)->end >= offset)
+	{
+		// Extends (or is already inside) the previous run
+		auto prev = std::prev(next);
+		prev->end = std::max(prev->end, end);
+		if (next != runs.end() && next->start <= prev->end)
+		{
+			prev->end = std::max(prev->end, next->end);
+			runs.erase(next);
+		}
+		return;
+	}
+	if (next != runs.end() && next->start <= end)
+	{
+		next->start = offset;
+		next->end = std::max(next->end, end);
+		return;
+	}
+	runs.insert(next, Extent{ offset, end });
+}
+bool Storage::NextOfType(const char* recName, std::streamoff& offset, std::streamoff* end) const
+{
+	auto type = extents.find(recName);
+	if (type == extents.end())
+		return false;
+	const std::vector<Extent>& runs = type->second;
+	auto next = std::upper_bound(runs.begin(), runs.end(), offset,
+		[](std::streamoff value, const Extent& e) { return value < e.start; });
+	if (next != runs.begin() && offset < std::prev(next)->end)
+	{
+		if (end != nullptr)
+			*end = std::prev(next)->end;
+		return true;
+	}
+	if (next == runs.end())
+		return false;
+	offset = next->start;
+	if (end != nullptr)
+		*end = next->end;
+	return true;
+}
+std::vector<std::pair<std::streamoff, std::streamoff>> Storage::ScanChunks(const char* recName,
+	int recSize, std::size_t chunkBytes)
+{
+	std::vector<std::pair<std::streamoff, std::streamoff>> chunks;
+	auto type = extents.find(recName);
+	if (type == extents.end())
+		return chunks;
+	std::streamoff step = recSize > 0 ?
+		std::max<std::streamoff>(1, chunkBytes / recSize) * recSize : 0;
+	for (const Extent& extent : type->second)
+	{
+		std::streamoff start = extent.start;
+		while (start < extent.end)
+		{
+			std::streamoff end = step ? std::min(extent.end, start + step) : extent.end;
+			// Only split where a record of that size really starts
+			if (end < extent.end)
+			{
+				const char* at = View(end, sizeof(int));
+				int size = 0;
+				if (at != nullptr)
+					memcpy(&size, at, sizeof(size));
+				if (size != recSize)
+					end = extent.end;
+			}
+			chunks.emplace_back(start, end);
+			start = end;
+		}
+	}
+	return chunks;
+}
+void Storage::SetScanThreads(unsigned int threads)
+{
+	scanThreads = threads;
+}
+unsigned int Storage::ScanThreads(void) const
+{
+	if (scanThreads != 0)
+		return scanThreads;
+	unsigned int cores = std::thread::hardware_concurrency();
+	return cores != 0 ? cores : 1;
+}
+void Storage::UnindexRecord(long long primaryKey)
+{
+	if (primaryIndex.erase(primaryKey))
+		indexDirty = true;
+}
+bool Storage::IsIndexable(const recKey* k)
+{
+	return k->typeInfo == typeid(bool) ||
+		k->typeInfo == typeid(char) ||
+		k->typeInfo == typeid(signed char) ||
+		k->typeInfo == typeid(unsigned char) ||
+		k->typeInfo == typeid(signed short int) ||
+		k->typeInfo == typeid(signed  int) ||
+		k->typeInfo == typeid(signed long int) ||
+		k->typeInfo == typeid(signed long long int) ||
+		k->typeInfo == typeid(unsigned short int) ||
+		k->typeInfo == typeid(unsigned  int) ||
+		k->typeInfo == typeid(unsigned long int);
+}
+// Widens the field the same way Record::processSeek does before comparing
+long long Storage::FieldValue(const FieldIndex& index, const char* body)
+{
+	const char* field = body + index.offset;
+	const std::type_info& t = *index.typeInfo;
+	if (t == typeid(bool) || t == typeid(char) || t == typeid(signed char) || t == typeid(unsigned char))
+		return field[0];
+	if (t == typeid(signed short int))
+	{
+		signed short int tmp;
+		memcpy(&tmp, field, sizeof(tmp));
+		return tmp;
+	}
+	if (t == typeid(signed  int))
+	{
+		signed  int tmp;
+		memcpy(&tmp, field, sizeof(tmp));
+		return tmp;
+	}
+	if (t == typeid(signed long int))
+	{
+		signed long int tmp;
+		memcpy(&tmp, field, sizeof(tmp));
+		return tmp;
+	}
+	if (t == typeid(signed long long int))
+	{
+		signed long long int tmp;
+		memcpy(&tmp, field, sizeof(tmp));
+		return tmp;
+	}
+	if (t == typeid(unsigned short int))
+	{
+		unsigned short int tmp;
+		memcpy(&tmp, field, sizeof(tmp));
+		return tmp;
+	}
+	if (t == typeid(unsigned  int))
+	{
+		unsigned  int tmp;
+		memcpy(&tmp, field, sizeof(tmp));
+		return tmp;
+	}
+	unsigned long int tmp;
+	memcpy(&tmp, field, sizeof(tmp));
+	return tmp;
+}
+Storage::FieldIndex* Storage::FindFieldIndex(const char* recName, const recKey* k)
+{
+	for (auto& index : fieldIndexes)
+	{
+		if (index.recName == recName && index.offset == k->offset &&
+			index.sz == k->sz && *index.typeInfo == k->typeInfo)
+			return &index;
+	}
+	return nullptr;
+}
+bool Storage::HasFieldIndex(const char* recName, const recKey* k) const
+{
+	return const_cast<Storage*>(this)->FindFieldIndex(recName, k) != nullptr;
+}
+bool Storage::AddFieldIndex(const char* recName, const recKey* k)
+{
+	if (!IsIndexable(k))
+		return false;
+	if (FindFieldIndex(recName, k))
+		return true;
+
+	FieldIndex index{};
+	index.recName = recName;
+	index.offset = k->offset;
+	index.sz = k->sz;
+	index.typeInfo = &k->typeInfo;
+	fieldIndexes.push_back(std::move(index));
+	BuildFieldIndex(fieldIndexes.back());
+	return true;
+}
+void Storage::BuildFieldIndex(FieldIndex& index)
+{
+	index.ordered.clear();
+	index.hashed.clear();
+	index.byRecord.clear();
+	fieldGeneration++;
+
+	HEADER header;
+	std::streamoff offset = 0;
+	while (NextOfType(index.recName.c_str(), offset))
+	{
+		const char* rec = View(offset, sizeof(HEADER));
+		if (rec == nullptr)
+			break;
+		memcpy(&header, rec, sizeof(HEADER));
+		if (header.RecSize == 0)
+			break;
+		if (index.recName == header.RecName)
+		{
+			const char* body = View(offset + sizeof(int) + REC_NAME_SIZE, header.RecSize - sizeof(int) - REC_NAME_SIZE);
+			if (body == nullptr)
+				break;
+			AddFieldEntry(index, offset, FieldValue(index, body));
+		}
+		offset += header.RecSize;
+	}
+}
+void Storage::AddFieldEntry(FieldIndex& index, std::streamoff offset, long long value)
+{
+	index.ordered.emplace(value, offset);
+	index.hashed.emplace(value, offset);
+	index.byRecord[offset] = value;
+}
+void Storage::IndexFields(const char* recName, std::streamoff offset, const char* body, int recSize)
+{
+	UnindexFields(recName, offset);
+	for (auto& index : fieldIndexes)
+	{
+		if (index.recName != recName)
+			continue;
+		AddFieldEntry(index, offset, FieldValue(index, body));
+		fieldGeneration++;
+	}
+	std::lock_guard<std::mutex> lock(zoneLock);
+	for (auto& map : zoneMaps)
+	{
+		if (map->recName == recName)
+			AddToZone(*map, offset, recSize, body);
+	}
+}
+void Storage::UnindexFields(const char* recName, std::streamoff offset)
+{
+	for (auto& index : fieldIndexes)
+	{
+		if (index.recName != recName)
+			continue;
+		auto rec = index.byRecord.find(offset);
+		if (rec == index.byRecord.end())
+			continue;
+
+		auto range = index.ordered.equal_range(rec->second);
+		for (auto it = range.first; it != range.second; ++it)
+		{
+			if (it->second == offset)
+			{
+				index.ordered.erase(it);
+				break;
+			}
+		}
+		auto hashed = index.hashed.equal_range(rec->second);
+		for (auto it = hashed.first; it != hashed.second; ++it)
+		{
+			if (it->second == offset)
+			{
+				index.hashed.erase(it);
+				break;
+			}
+		}
+		index.byRecord.erase(rec);
+		fieldGeneration++;
+	}
+}
+void Storage::ZoneMaps(const char* recName, const SeekPlan& plan, std::vector<const ZoneMap*>& maps)
+{
+	const std::vector<SeekPlan::Term>& terms = plan.Terms();
+	maps.assign(terms.size(), nullptr);
+	std::lock_guard<std::mutex> lock(zoneLock);
+	for (std::size_t j = 0; j < terms.size(); j++)
+	{
+		const SeekPlan::Term& t = terms[j];
+		if (!t.vectorized || t.constant != -1 || t.vcomp == Comp::NotEqual)
+			continue;
+		for (auto& map : zoneMaps)
+		{
+			if (map->recName == recName && map->offset == t.offset && map->kind == t.kind)
+				maps[j] = map.get();
+		}
+		if (maps[j] == nullptr)
+		{
+			ZoneMap* map = new ZoneMap{};
+			map->recName = recName;
+			map->offset = t.offset;
+			map->kind = t.kind;
+			zoneMaps.emplace_back(map);
+			BuildZoneMap(*map);
+			maps[j] = map;
+			zonesChanged = true;
+		}
+	}
+}
+void Storage::BuildZoneMap(ZoneMap& map)
+{
+	HEADER header;
+	std::streamoff offset = 0;
+	while (NextOfType(map.recName.c_str(), offset))
+	{
+		const char* rec = View(offset, sizeof(HEADER));
+		if (rec == nullptr)
+			break;
+		memcpy(&header, rec, sizeof(HEADER));
+		if (header.RecSize < static_cast<int>(sizeof(HEADER)))
+			break;
+		if (map.recName == header.RecName)
+		{
+			const char* body = View(offset + sizeof(int) + REC_NAME_SIZE, header.RecSize - sizeof(int) - REC_NAME_SIZE);
+			if (body == nullptr)
+				break;
+			AddToZone(map, offset, header.RecSize, body);
+		}
+		offset += header.RecSize;
+	}
+}
+void Storage::AddToZone(ZoneMap& map, std::streamoff offset, int recSize, const char* body)
+{
+	if (map.offset + FieldSize(map.kind) > recSize - sizeof(int) - REC_NAME_SIZE)
+		return;
+	std::size_t block = static_cast<std::size_t>(offset / ZoneBytes);
+	if (block >= map.zones.size())
+	{
+		map.zones.resize(block + 1);
+		map.ends.resize(block + 1, 0);
+	}
+	SeekPlan::Zone& zone = map.zones[block];
+	zone.kind = map.kind;
+	zone.Add(body + map.offset);
+	map.ends[block] = std::max(map.ends[block], offset + recSize);
+}
+void Storage::ZoneRecord(const char* recName, std::streamoff offset, int recSize)
+{
+	if (zoneMaps.empty() || recSize < static_cast<int>(sizeof(HEADER)))
+		return;
+	const char* body = nullptr;
+	for (auto& map : zoneMaps)
+	{
+		if (map->recName != recName)
+			continue;
+		if (body == nullptr)
+			body = View(offset + sizeof(int) + REC_NAME_SIZE, recSize - sizeof(int) - REC_NAME_SIZE);
+		if (body == nullptr)
+			return;
+		AddToZone(*map, offset, recSize, body);
+	}
+}
+bool Storage::BlockMayMatch(const SeekPlan& plan, const std::vector<const ZoneMap*>& maps,
+	std::streamoff offset, std::streamoff& end)
+{
+	std::size_t block = static_cast<std::size_t>(offset / ZoneBytes);
+	end = -1;
+	for (const ZoneMap* map : maps)
+	{
+		if (map != nullptr && block < map->zones.size())
+		{
+			end = map->ends[block];
+			break;
+		}
+	}
+	if (end <= offset)
+		return true;
+	const SeekPlan::Term* first = plan.Terms().data();
+	return plan.MayMatch([&](const SeekPlan::Term& t) -> const SeekPlan::Zone*
+	{
+		const ZoneMap* map = maps[&t - first];
+		return map != nullptr && block < map->zones.size() ? &map->zones[block] : nullptr;
+	});
+}
+bool Storage::FieldCandidates(const char* recName, const recKey* k, long long key,
+	std::shared_ptr<const std::vector<std::streamoff>>& offsets)
+{
+	FieldIndex* index = FindFieldIndex(recName, k);
+	if (index == nullptr || k->comp == Comp::NotEqual)
+		return false;
+
+	// Readers share the cache; each keeps the list it got alive
+	std::lock_guard<std::mutex> lock(candidatesLock);
+	if (lastCandidates.offsets && lastCandidates.index == index && lastCandidates.comp == k->comp &&
+		lastCandidates.key == key && lastCandidates.generation == fieldGeneration)
+	{
+		offsets = lastCandidates.offsets;
+		return true;
+	}
+
+	// processSeek compares chars as "key comp value", everything else as
+	// "value comp key"; flip the char ranges so both read "value comp key".
+	Comp comp = k->comp;
+	bool isChar = *index->typeInfo == typeid(char) ||
+		*index->typeInfo == typeid(signed char) ||
+		*index->typeInfo == typeid(unsigned char);
+	if (isChar)
+	{
+		if (comp == Comp::Greater) comp = Comp::Smaller;
+		else if (comp == Comp::Smaller) comp = Comp::Greater;
+		else if (comp == Comp::GreaterEq) comp = Comp::SmallerEq;
+		else if (comp == Comp::SmallerEq) comp = Comp::GreaterEq;
+	}
+
+	auto candidates = std::make_shared<std::vector<std::streamoff>>();
+	std::vector<std::streamoff>& out = *candidates;
+	if (comp == Comp::Equal)
+	{
+		auto range = index->hashed.equal_range(key);
+		for (auto it = range.first; it != range.second; ++it)
+			out.push_back(it->second);
+	}
+	else
+	{
+		auto from = index->ordered.begin();
+		auto to = index->ordered.end();
+		if (comp == Comp::Greater)
+			from = index->ordered.upper_bound(key);
+		else if (comp == Comp::GreaterEq)
+			from = index->ordered.lower_bound(key);
+		else if (comp == Comp::Smaller)
+			to = index->ordered.lower_bound(key);
+		else
+			to = index->ordered.upper_bound(key);
+		for (auto it = from; it != to; ++it)
+			out.push_back(it->second);
+	}
+	std::sort(out.begin(), out.end());
+
+	lastCandidates.index = index;
+	lastCandidates.comp = k->comp;
+	lastCandidates.key = key;
+	lastCandidates.generation = fieldGeneration;
+	lastCandidates.offsets = candidates;
+	offsets = candidates;
+	return true;
+}
+void Storage::RebuildIndex(void)
+{
+	version++;
+	pool.Clear();
+	objects.Clear();
+	// The maps already built are filled again by the scan below
+	for (auto& map : zoneMaps)
+	{
+		map->zones.clear();
+		map->ends.clear();
+	}
+	primaryIndex.clear();
+	extents.clear();
+	freeSlots.clear();
+	typeCounts.clear();
+	recordCount = 0;
+	dataEnd = 0;
+	indexDirty = true;
+	// A deleted record has lost its name; keep the types known for its slot
+	std::map<std::streamoff, std::string> knownTypes;
+	knownTypes.swap(slotTypes);
+	if (file == nullptr || !file->is_open())
+		return;
+
+	HEADER header;
+	std::streamoff offset = 0;
+	while (true)
+	{
+		const char* rec = View(offset, sizeof(HEADER));
+		if (rec == nullptr)
+			break;
+		memcpy(&header, rec, sizeof(HEADER));
+		if (header.RecSize == 0)
+			break;
+		if (header.primaryKey)
+		{
+			primaryIndex.emplace(header.primaryKey, offset);
+			keyHighWater = std::max(keyHighWater, header.primaryKey);
+			CountType(header.RecName, 1, 0);
+			ZoneRecord(header.RecName, offset, header.RecSize);
+		}
+		else
+		{
+			freeSlots[header.RecSize].push_back(offset);   // deleted record
+			auto type = knownTypes.find(offset);
+			std::string recName = type != knownTypes.end() ? type->second : "";
+			if (!recName.empty())
+				slotTypes[offset] = recName;
+			CountType(recName, 0, 1);
+		}
+		AddToExtent(header.RecName, offset, header.RecSize);
+		offset += header.RecSize;
+		recordCount++;
+	}
+	dataEnd = offset;
+}
+bool Storage::LoadIndex(void)
+{
+	std::ifstream idx(indexFileName, std::ios::in | std::ios::binary);
+	if (!idx)
+		return false;
+
+	SUPERBLOCK super;
+	idx.read((char*)(&super), sizeof(SUPERBLOCK));
+	if (idx.gcount() != sizeof(SUPERBLOCK) ||
+		memcmp(super.Magic, indexMagic, sizeof(indexMagic)) != 0 ||
+		super.Version != indexVersion)
+		return false;
+	// Keys handed out before stay used even if the index has to be rebuilt
+	keyHighWater = std::max(keyHighWater, super.HighWater);
+	if (super.Dirty != 0 || super.DataSize != DataFileSize() || super.Records < 0 ||
+		super.Count < 0 || super.Count > super.Records)
+		return false;
+
+	// Any failure below leaves the index empty, to be rebuilt
+	auto fail = [this]()
+	{
+		typeCounts.clear();
+		primaryIndex.clear();
+		extents.clear();
+		freeSlots.clear();
+		slotTypes.clear();
+		zoneMaps.clear();
+		return false;
+	};
+	TYPECOUNT count;
+	for (long long int i = 0; i < super.Types; i++)
+	{
+		idx.read((char*)(&count), sizeof(TYPECOUNT));
+		if (idx.gcount() != sizeof(TYPECOUNT))
+			return fail();
+		count.RecName[REC_NAME_SIZE - 1] = '\0';
+		typeCounts[count.RecName] = TypeCount{ count.Live, count.Deleted };
+	}
+
+	idx.seekg(super.IndexRoot, std::ios::beg);
+	INDEXENTRY entry;
+	for (long long int i = 0; i < super.Count; i++)
+	{
+		idx.read((char*)(&entry), sizeof(INDEXENTRY));
+		if (idx.gcount() != sizeof(INDEXENTRY))
+			return fail();
+		// Entries are saved in key order, so each insert lands at the end
+		primaryIndex.emplace_hint(primaryIndex.end(), entry.primaryKey, entry.offset);
+	}
+
+	long long int types = 0;
+	idx.read((char*)(&types), sizeof(types));
+	if (idx.gcount() != sizeof(types))
+		return fail();
+	EXTENTHEADER type;
+	EXTENTENTRY run;
+	for (long long int i = 0; i < types; i++)
+	{
+		idx.read((char*)(&type), sizeof(EXTENTHEADER));
+		if (idx.gcount() != sizeof(EXTENTHEADER))
+			return fail();
+		type.RecName[REC_NAME_SIZE - 1] = '\0';
+		std::vector<Extent>& runs = extents[type.RecName];
+		for (long long int j = 0; j < type.Count; j++)
+		{
+			idx.read((char*)(&run), sizeof(EXTENTENTRY));
+			if (idx.gcount() != sizeof(EXTENTENTRY))
+				return fail();
+			runs.push_back(Extent{ run.start, run.end });
+		}
+	}
+
+	long long int slots = 0;
+	idx.read((char*)(&slots), sizeof(slots));
+	if (idx.gcount() != sizeof(slots))
+		return fail();
+	FREESLOT slot;
+	for (long long int i = 0; i < slots; i++)
+	{
+		idx.read((char*)(&slot), sizeof(FREESLOT));
+		if (idx.gcount() != sizeof(FREESLOT))
+			return fail();
+		freeSlots[static_cast<int>(slot.Size)].push_back(slot.Offset);
+		slot.RecName[REC_NAME_SIZE - 1] = '\0';
+		if (slot.RecName[0] != '\0')
+			slotTypes[slot.Offset] = slot.RecName;
+	}
+
+	long long int maps = 0;
+	idx.read((char*)(&maps), sizeof(maps));
+	if (idx.gcount() != sizeof(maps))
+		return fail();
+	ZONEHEADER zoneHeader;
+	ZONEENTRY zone;
+	for (long long int i = 0; i < maps; i++)
+	{
+		idx.read((char*)(&zoneHeader), sizeof(ZONEHEADER));
+		if (idx.gcount() != sizeof(ZONEHEADER) || zoneHeader.Offset < 0 || zoneHeader.Blocks < 0 ||
+			zoneHeader.Kind < static_cast<int>(FieldKind::Int8) || zoneHeader.Kind > static_cast<int>(FieldKind::UInt64))
+			return fail();
+		zoneHeader.RecName[REC_NAME_SIZE - 1] = '\0';
+		ZoneMap* map = new ZoneMap{};
+		zoneMaps.emplace_back(map);
+		map->recName = zoneHeader.RecName;
+		map->offset = static_cast<std::size_t>(zoneHeader.Offset);
+		map->kind = static_cast<FieldKind>(zoneHeader.Kind);
+		for (long long int j = 0; j < zoneHeader.Blocks; j++)
+		{
+			idx.read((char*)(&zone), sizeof(ZONEENTRY));
+			if (idx.gcount() != sizeof(ZONEENTRY))
+				return fail();
+			SeekPlan::Zone z;
+			z.kind = map->kind;
+			z.empty = zone.Empty != 0;
+			z.min = zone.Min;
+			z.max = zone.Max;
+			map->zones.push_back(z);
+			map->ends.push_back(zone.End);
+		}
+	}
+	recordCount = super.Records;
+	dataEnd = super.DataSize;
+	return true;
+}
+void Storage::SaveIndex(void)
+{
+	std::lock_guard<std::mutex> lock(zoneLock);
+	if ((!indexDirty && !indexMarked && !zonesChanged) || file == nullptr || !file->is_open())
+		return;
+	file->flush();
+
+	std::ofstream idx(indexFileName, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!idx)
+	{
+		std::cerr << "Error: could not write index file " << indexFileName << std::endl;
+		return;
+	}
+	SUPERBLOCK super;
+	memcpy(super.Magic, indexMagic, sizeof(indexMagic));
+	super.Version = indexVersion;
+	super.DataSize = DataFileSize();
+	super.Records = recordCount;
+	super.HighWater = keyHighWater;
+	super.Types = typeCounts.size();
+	super.IndexRoot = sizeof(SUPERBLOCK) + typeCounts.size() * sizeof(TYPECOUNT);
+	super.Count = primaryIndex.size();
+	super.Dirty = 0;
+	idx.write((char*)(&super), sizeof(SUPERBLOCK));
+
+	TYPECOUNT count;
+	for (const auto& it : typeCounts)
+	{
+		memset(count.RecName, 0, REC_NAME_SIZE);
+		strncpy(count.RecName, it.first.c_str(), REC_NAME_SIZE - 1);
+		count.Live = it.second.live;
+		count.Deleted = it.second.deleted;
+		idx.write((char*)(&count), sizeof(TYPECOUNT));
+	}
+
+	INDEXENTRY entry;
+	for (const auto& it : primaryIndex)
+	{
+		entry.primaryKey = it.first;
+		entry.offset = it.second;
+		idx.write((char*)(&entry), sizeof(INDEXENTRY));
+	}
+
+	long long int types = extents.size();
+	idx.write((char*)(&types), sizeof(types));
+	EXTENTHEADER type;
+	EXTENTENTRY run;
+	for (const auto& it : extents)
+	{
+		memset(type.RecName, 0, REC_NAME_SIZE);
+		strncpy(type.RecName, it.first.c_str(), REC_NAME_SIZE - 1);
+		type.Count = it.second.size();
+		idx.write((char*)(&type), sizeof(EXTENTHEADER));
+		for (const Extent& e : it.second)
+		{
+			run.start = e.start;
+			run.end = e.end;
+			idx.write((char*)(&run), sizeof(EXTENTENTRY));
+		}
+	}
+
+	// Free slots are saved with the type of the record deleted from them
+	long long int slots = 0;
+	for (const auto& it : freeSlots)
+		slots += it.second.size();
+	idx.write((char*)(&slots), sizeof(slots));
+	FREESLOT slot;
+	for (const auto& it : freeSlots)
+	{
+		for (std::streamoff offset : it.second)
+		{
+			slot.Size = it.first;
+			slot.Offset = offset;
+			memset(slot.RecName, 0, REC_NAME_SIZE);
+			auto known = slotTypes.find(offset);
+			if (known != slotTypes.end())
+				strncpy(slot.RecName, known->second.c_str(), REC_NAME_SIZE - 1);
+			idx.write((char*)(&slot), sizeof(FREESLOT));
+		}
+	}
+
+	long long int maps = zoneMaps.size();
+	idx.write((char*)(&maps), sizeof(maps));
+	ZONEHEADER zoneHeader;
+	ZONEENTRY zone;
+	for (const auto& map : zoneMaps)
+	{
+		memset(zoneHeader.RecName, 0, REC_NAME_SIZE);
+		strncpy(zoneHeader.RecName, map->recName.c_str(), REC_NAME_SIZE - 1);
+		zoneHeader.Offset = map->offset;
+		zoneHeader.Kind = static_cast<int>(map->kind);
+		zoneHeader.Blocks = map->zones.size();
+		idx.write((char*)(&zoneHeader), sizeof(ZONEHEADER));
+		for (std::size_t j = 0; j < map->zones.size(); j++)
+		{
+			zone.Empty = map->zones[j].empty ? 1 : 0;
+			zone.Min = map->zones[j].min;
+			zone.Max = map->zones[j].max;
+			zone.End = map->ends[j];
+			idx.write((char*)(&zone), sizeof(ZONEENTRY));
+		}
+	}
+	idx.close();
+	if (idx.fail())
+	{
+		std::cerr << "Error: could not write index file " << indexFileName << std::endl;
+		return;
+	}
+	indexDirty = false;
+	indexMarked = false;
+	zonesChanged = false;
+	keyLease = keyHighWater;
+	markedLease = 0;
+}
+// Sets the dirty flag of the superblock on disk, and its key mark to
+// keyLease, before the data file is written after the index was loaded or
+// saved, so that an index left by a crash is rebuilt and its keys are not
+// handed out again. The rest of the index file is left as is. Called with
+// keyLock held.
+void Storage::MarkIndex(void)
+{
+	if (indexMarked && keyLease <= markedLease)
+		return;
+	int fd = ::open(indexFileName.c_str(), O_RDWR | O_CREAT, 0644);
+	if (fd == -1)
+	{
+		std::cerr << "Error: could not write index file " << indexFileName << std::endl;
+		return;
+	}
+	SUPERBLOCK super;
+	if (pread(fd, &super, sizeof(SUPERBLOCK), 0) != sizeof(SUPERBLOCK) ||
+		memcmp(super.Magic, indexMagic, sizeof(indexMagic)) != 0 || super.Version != indexVersion)
+	{
+		memset(&super, 0, sizeof(SUPERBLOCK));
+		memcpy(super.Magic, indexMagic, sizeof(indexMagic));
+		super.Version = indexVersion;
+		super.DataSize = -1;
+		super.IndexRoot = sizeof(SUPERBLOCK);
+	}
+	super.Dirty = 1;
+	super.HighWater = std::max({ super.HighWater, keyHighWater, keyLease });
+	if (pwrite(fd, &super, sizeof(SUPERBLOCK), 0) != sizeof(SUPERBLOCK) || fsync(fd) != 0)
+		std::cerr << "Error: could not write index file " << indexFileName << std::endl;
+	else
+	{
+		indexMarked = true;
+		markedLease = keyLease;
+	}
+	::close(fd);
+}
+std::streamoff Storage::DataFileSize(void)
+{
+	if (file == nullptr || !file->is_open())
+		return 0;
+	file->clear();
+	file->seekg(0, std::ios::end);
+	std::streamoff size = file->tellg();
+	file->clear();
+	return size;
+}
+// Writes of a transaction stay in the stream buffer until someone reads
+void Storage::FlushPending(void)
+{
+	if (unflushed)
+	{
+		std::lock_guard<std::recursive_mutex> lock(streamLock);
+		if (unflushed)
+		{
+			file->flush();
+			unflushed = false;
+		}
+	}
+}
+const char* Storage::View(std::streamoff offset, std::size_t n)
+{
+	if (file == nullptr || offset < 0)
+		return nullptr;
+	FlushPending();
+
+	if (memoryMapped)
+	{
+		// The file only grows between remaps, so a read past the mapped
+		// size is either the end of the data or a record appended since.
+		// The size is published after the address, so the address read
+		// here covers at least that many bytes.
+		std::size_t size = mappedSize.load(std::memory_order_acquire);
+		if (static_cast<std::size_t>(offset) + n > size)
+		{
+			if (!Remap())
+				return nullptr;
+			size = mappedSize.load(std::memory_order_acquire);
+			if (static_cast<std::size_t>(offset) + n > size)
+				return nullptr;
+		}
+		return mapped.load(std::memory_order_acquire) + offset;
+	}
+
+	static thread_local std::vector<char> viewBuffer;
+	if (viewBuffer.size() < n)
+		viewBuffer.resize(n);
+	if (Read(offset, viewBuffer.data(), n) != n)
+		return nullptr;
+	return viewBuffer.data();
+}
+std::size_t Storage::Read(std::streamoff offset, char* dest, std::size_t n)
+{
+	if (file == nullptr || offset < 0)
+		return 0;
+	FlushPending();
+	return pool.Read(offset, dest, n);
+}
+BufferPool& Storage::Pool(void)
+{
+	FlushPending();
+	return pool;
+}
+AsyncIO& Storage::IO(void)
+{
+	return io;
+}
+ObjectCache& Storage::Objects(void)
+{
+	return objects;
+}
+// Reads the file itself, for the buffer pool
+int Storage::ReadFd(void)
+{
+	if (mapFd == -1)
+	{
+		std::lock_guard<std::mutex> lock(mapLock);
+		if (mapFd == -1)
+			mapFd = ::open(dataFileName.c_str(), O_RDONLY);
+	}
+	return mapFd;
+}
+std::size_t Storage::ReadFile(std::streamoff offset, char* dest, std::size_t n)
+{
+	int fd = ReadFd();
+	if (fd == -1)
+		return 0;
+	std::size_t done = 0;
+	while (done < n)
+	{
+		ssize_t got = pread(fd, dest + done, n - done, offset + done);
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got <= 0)
+			break;
+		done += static_cast<std::size_t>(got);
+	}
+	return done;
+}
+void Storage::ReadFileBatch(std::vector<AsyncIO::Request>& requests)
+{
+	int fd = ReadFd();
+	if (fd == -1)
+	{
+		for (AsyncIO::Request& r : requests)
+			r.done = 0;
+		return;
+	}
+	io.ReadBatch(fd, requests);
+}
+unsigned long long Storage::Version(void) const
+{
+	return version;
+}
+void Storage::SetMemoryMapped(bool on)
+{
+	memoryMapped = on;
+	if (on)
+		Remap();
+	else
+		Unmap();
+}
+bool Storage::IsMemoryMapped(void) const
+{
+	return memoryMapped;
+}
+bool Storage::Remap(void)
+{
+	if (file == nullptr)
+		return false;
+	std::lock_guard<std::mutex> lock(mapLock);
+	if (mapFd == -1)
+	{
+		mapFd = ::open(dataFileName.c_str(), O_RDONLY);
+		if (mapFd == -1)
+			return false;
+	}
+	struct stat st;
+	if (fstat(mapFd, &st) != 0)
+		return false;
+	std::size_t size = static_cast<std::size_t>(st.st_size);
+	if (size == mappedSize)
+		return mapped != nullptr;
+
+	void* addr = nullptr;
+	if (size != 0)
+	{
+		addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, mapFd, 0);
+		if (addr == MAP_FAILED)
+			return false;   // keep the old mapping
+	}
+	if (mapped != nullptr)
+		retired.emplace_back(mapped.load(), mappedSize.load());
+	if (addr == nullptr)
+	{
+		// Only truncation empties the file, under an exclusive Access
+		mappedSize = 0;
+		mapped = nullptr;
+		return false;
+	}
+	// The size is stored last, so readers never see a size larger than
+	// the mapping they load
+	mapped.store(static_cast<char*>(addr), std::memory_order_release);
+	mappedSize.store(size, std::memory_order_release);
+	return true;
+}
+void Storage::Unmap(void)
+{
+	std::lock_guard<std::mutex> lock(mapLock);
+	for (const auto& m : retired)
+		munmap(m.first, m.second);
+	retired.clear();
+	if (mapped != nullptr)
+		munmap(mapped, mappedSize);
+	mapped = nullptr;
+	mappedSize = 0;
+	if (mapFd != -1)
+		::close(mapFd);
+	mapFd = -1;
+}
+// Unmaps the mappings replaced by Remap; called with the exclusive lock
+void Storage::Reclaim(void)
+{
+	std::lock_guard<std::mutex> lock(mapLock);
+	for (const auto& m : retired)
+		munmap(m.first, m.second);
+	retired.clear();
+}
+bool Storage::InTransaction(void) const
+{
+	return inTransaction;
+}
+bool Storage::Begin(void)
+{
+	if (file == nullptr || logFd == -1)
+		return false;
+	if (inTransaction)
+	{
+		std::cout << "A transaction is already active." << std::endl;
+		return false;
+	}
+	file->flush();
+	transactionStart = DataFileSize();
+	undo.clear();
+	inTransaction = true;
+	AppendLog(LOG_BEGIN, transactionStart, nullptr, 0);
+	return true;
+}
+bool Storage::Commit(void)
+{
+	if (!inTransaction)
+	{
+		std::cout << "There is no active transaction." << std::endl;
+		return false;
+	}
+	AppendLog(LOG_COMMIT, 0, nullptr, 0);
+	// Group commit: one fsync makes every write of the transaction durable.
+	// Under the lock: a checkpoint may replace the log file.
+	bool synced;
+	{
+		std::lock_guard<std::mutex> lock(logLock);
+		synced = fsync(logFd) == 0;
+	}
+	if (!synced)
+	{
+		std::cerr << "Error: fsync() of " << logFileName << " failed." << std::endl;
+		return false;
+	}
+	file->flush();
+	unflushed = false;
+	inTransaction = false;
+	undo.clear();
+
+	// Once the data file is synced the log is no longer needed. A running
+	// checkpoint takes this commit along on its next round, so the commit
+	// does not wait for it.
+	{
+		std::lock_guard<std::mutex> lock(logLock);
+		checkpointWanted = true;
+		if (checkpointing)
+			return true;
+		checkpointing = true;
+	}
+	WaitCheckpoint();   // the last one has left its loop
+	checkpoint = std::async(std::launch::async, [this]()
+	{
+		while (true)
+		{
+			{
+				std::lock_guard<std::mutex> lock(logLock);
+				if (!checkpointWanted)
+				{
+					checkpointing = false;
+					return;
+				}
+				checkpointWanted = false;
+			}
+			Checkpoint();
+		}
+	});
+	return true;
+}
+bool Storage::Rollback(void)
+{
+	if (!inTransaction)
+	{
+		std::cout << "There is no active transaction." << std::endl;
+		return false;
+	}
+	UndoImages(undo, transactionStart);
+	AppendLog(LOG_ROLLBACK, 0, nullptr, 0);
+	inTransaction = false;
+	unflushed = false;
+	undo.clear();
+
+	RebuildIndex();
+	for (auto& index : fieldIndexes)
+		BuildFieldIndex(index);
+	return true;
+}
+void Storage::LogWrite(std::streamoff offset, const char* data, std::size_t size)
+{
+	{
+		std::lock_guard<std::mutex> lock(keyLock);
+		MarkIndex();
+	}
+	if (!inTransaction)
+	{
+		// Recovery would replay the transactions still in the log over this
+		// untracked write, so the log is checkpointed before it
+		WaitCheckpoint();
+		bool logged;
+		{
+			std::lock_guard<std::mutex> lock(logLock);
+			logged = logSize != 0;
+		}
+		if (logged)
+		{
+			file->flush();
+			Checkpoint();
+			std::lock_guard<std::mutex> lock(logLock);
+			if (logSize != 0)
+				std::cerr << "Error: could not checkpoint " << logFileName << std::endl;
+		}
+		pool.Invalidate(offset, size);
+		return;
+	}
+	// Appended records are undone by truncating to the size at Begin
+	if (offset < transactionStart)
+	{
+		std::size_t n = static_cast<std::size_t>(std::min<std::streamoff>(size, transactionStart - offset));
+		const char* before = View(offset, n);
+		if (before != nullptr)
+		{
+			undo.push_back(LogImage{ offset, std::vector<char>(before, before + n) });
+			AppendLog(LOG_UNDO, offset, before, n);
+		}
+	}
+	AppendLog(LOG_REDO, offset, data, size);
+	// After taking the before image, which may have loaded these pages
+	pool.Invalidate(offset, size);
+}
+void Storage::Written(void)
+{
+	version++;
+	if (inTransaction)
+		unflushed = true;
+	else
+		file->flush();
+}
+bool Storage::OpenLog(void)
+{
+	logFd = ::open(logFileName.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+	if (logFd == -1)
+	{
+		std::cerr << "Error: could not open log file " << logFileName << std::endl;
+		return false;
+	}
+	struct stat st;
+	logSize = fstat(logFd, &st) == 0 ? st.st_size : 0;
+	logCommitted = 0;
+	return true;
+}
+// Redoes committed transactions found in the log and undoes a trailing
+// unfinished one. Returns true if the data file was changed.
+bool Storage::Recover(void)
+{
+	if (logSize == 0)
+		return false;
+
+	std::vector<LogImage> redo;
+	std::vector<LogImage> pendingUndo;
+	std::streamoff beginSize = -1;
+	bool changed = false;
+
+	lseek(logFd, 0, SEEK_SET);
+	LOGENTRY entry;
+	while (read(logFd, &entry, sizeof(LOGENTRY)) == sizeof(LOGENTRY))
+	{
+		LogImage image{ entry.Offset, std::vector<char>(static_cast<std::size_t>(entry.Size)) };
+		if (entry.Size > 0 && read(logFd, image.data.data(), image.data.size()) != static_cast<ssize_t>(image.data.size()))
+			break;  // torn tail: that transaction never committed
+		switch (entry.Type)
+		{
+		case LOG_BEGIN:
+			beginSize = entry.Offset;
+			redo.clear();
+			pendingUndo.clear();
+			break;
+		case LOG_UNDO:
+			pendingUndo.push_back(image);
+			break;
+		case LOG_REDO:
+			redo.push_back(image);
+			break;
+		case LOG_COMMIT:
+			for (const LogImage& r : redo)
+			{
+				file->clear();
+				file->seekp(r.offset, std::ios::beg);
+				file->write(r.data.data(), r.data.size());
+				changed = true;
+			}
+			redo.clear();
+			pendingUndo.clear();
+			beginSize = -1;
+			break;
+		case LOG_ROLLBACK:
+			UndoImages(pendingUndo, beginSize);
+			redo.clear();
+			pendingUndo.clear();
+			beginSize = -1;
+			changed = true;
+			break;
+		}
+	}
+	if (beginSize != -1)
+	{
+		UndoImages(pendingUndo, beginSize);
+		changed = true;
+	}
+	file->flush();
+	logCommitted = logSize;   // nothing in the log is pending any more
+	Checkpoint();
+	return changed;
+}
+// Restores before images, newest first, and drops what was appended
+void Storage::UndoImages(const std::vector<LogImage>& images, std::streamoff size)
+{
+	file->flush();
+	for (auto it = images.rbegin(); it != images.rend(); ++it)
+	{
+		file->clear();
+		file->seekp(it->offset, std::ios::beg);
+		file->write(it->data.data(), it->data.size());
+	}
+	file->flush();
+	Truncate(size);
+}
+void Storage::AppendLog(int type, std::streamoff offset, const char* data, std::size_t size)
+{
+	std::lock_guard<std::mutex> lock(logLock);
+	LOGENTRY entry{ type, offset, static_cast<long long int>(size) };
+	std::vector<char> buffer(sizeof(LOGENTRY) + size);
+	memcpy(buffer.data(), &entry, sizeof(LOGENTRY));
+	if (size)
+		memcpy(buffer.data() + sizeof(LOGENTRY), data, size);
+	if (write(logFd, buffer.data(), buffer.size()) != static_cast<ssize_t>(buffer.size()))
+		std::cerr << "Error: could not write to log file " << logFileName << std::endl;
+	logSize += buffer.size();
+	if (type == LOG_COMMIT || type == LOG_ROLLBACK)
+		logCommitted = logSize;
+}
+// Syncs the data file and drops the log records it now covers: those up to
+// the end of the last finished transaction. Runs in the background after a
+// commit; the records of a transaction begun in the meantime are moved to
+// a new log, which replaces the old one with a rename.
+void Storage::Checkpoint(void)
+{
+	std::streamoff covered;
+	{
+		std::lock_guard<std::mutex> lock(logLock);
+		covered = logCommitted;
+	}
+	if (covered == 0)
+		return;
+	int fd = ::open(dataFileName.c_str(), O_RDONLY);
+	if (fd == -1)
+		return;
+	bool synced = fsync(fd) == 0;
+	::close(fd);
+
+	std::lock_guard<std::mutex> lock(logLock);
+	if (!synced || logFd == -1)
+		return;
+	if (logSize == covered)
+	{
+		if (ftruncate(logFd, 0) == 0)
+		{
+			logSize = 0;
+			logCommitted = 0;
+		}
+		return;
+	}
+	std::vector<char> tail(static_cast<std::size_t>(logSize - covered));
+	std::string tailFileName = logFileName + ".tail";
+	fd = -1;
+	if (pread(logFd, tail.data(), tail.size(), covered) == static_cast<ssize_t>(tail.size()) &&
+		(fd = ::open(tailFileName.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0644)) != -1 &&
+		write(fd, tail.data(), tail.size()) == static_cast<ssize_t>(tail.size()) &&
+		fsync(fd) == 0 && rename(tailFileName.c_str(), logFileName.c_str()) == 0)
+	{
+		::close(logFd);
+		logFd = fd;
+		logSize -= covered;
+		logCommitted -= covered;
+		return;
+	}
+	// The whole log is kept until the next checkpoint
+	if (fd != -1)
+	{
+		::close(fd);
+		remove(tailFileName.c_str());
+	}
+}
+void Storage::WaitCheckpoint(void)
+{
+	if (checkpoint.valid())
+		checkpoint.wait();
+}
+void Storage::Truncate(std::streamoff size)
+{
+	if (truncate(dataFileName.c_str(), size) != 0)
+		std::cerr << "Error: could not truncate " << dataFileName << std::endl;
+	file->clear();
+	pool.Clear();
+	if (memoryMapped)
+		Remap();
+}
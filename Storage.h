@@ -0,0 +1,315 @@
+#pragma once
+#include <atomic>
+#include <fstream>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Record.h"
+#include "AsyncIO.h"
+#include "BufferPool.h"
+#include "ObjectCache.h"
+#include "SeekPlan.h"
+
+class Database;
+
+// Per-database engine state (indexes and the files that back them).
+// It is kept here, keyed by the Database instance, so that the shared
+// Database/Record headers do not change layout.
+//
+// Thread safety: every Database/Record operation holds an Access on the
+// Storage of its database while it runs. Reads (Seek, Next, GetRecordByName,
+// GetRecordByIndex, GetRecordName, GetCount, Dump) share it; writes (Insert,
+// Update, Delete, CreateIndex, BulkInsert, transactions, Connect/Close) hold
+// it alone. Compact shares it while it copies and holds it alone to swap.
+// Reads go through View, which reads by position, so concurrent readers do
+// not disturb each other. A transaction belongs to the database, not to the
+// thread that began it.
+class Storage
+{
+public:
+	Storage(void);
+	static Storage& Get(const Database* db);
+	static void Release(const Database* db);
+
+	// Reader/writer lock on this database for the lifetime of the object.
+	// An operation called from within another one on the same thread (Dump
+	// loading records, Update checking IsDeleted) reuses the lock held.
+	class Access
+	{
+	public:
+		Access(Storage& storage, bool exclusive);
+		~Access();
+		Access(const Access&) = delete;
+		Access& operator=(const Access&) = delete;
+	private:
+		Storage* storage;    // nullptr: the lock was already held by this thread
+		bool exclusive;
+	};
+	// Held while the shared fstream is positioned for a reader, i.e. while
+	// a derived constructor reads the record GetRecordName stopped at
+	std::recursive_mutex& StreamLock(void);
+
+	// Called by Database::Connect/Close
+	void Open(std::fstream& dataFile, const std::string& fileName);
+	void Close(void);
+
+	// Primary key index: primaryKey -> offset of the record in the data file
+	bool FindRecord(long long primaryKey, std::streamoff& offset) const;
+	void IndexRecord(long long primaryKey, const char* recName, std::streamoff offset, int recSize);
+	void UnindexRecord(long long primaryKey);
+	void RebuildIndex(void);
+
+	// Free-space map: slots of deleted records, by record size. Insert
+	// takes a slot of exactly its size before appending to the file.
+	void FreeSlot(int recSize, std::streamoff offset, const char* recName);
+	bool AllocateSlot(int recSize, std::streamoff& offset);
+
+	// Record counts, kept by the writes and saved in the superblock of the
+	// index file. RecordCount is every record of the data file, deleted
+	// ones included. A deleted record loses its name on file, so deletes
+	// from before the index was last rebuilt count under the empty name.
+	long long RecordCount(void) const;
+	long long LiveCount(const std::string& recName) const;
+	void LiveCounts(std::map<std::string, long>& counts) const;
+	void DeletedCounts(std::map<std::string, long>& counts) const;
+
+	// Rewrites the live records into a new file, grouped by record type,
+	// and swaps it in with an atomic rename. Returns the bytes reclaimed,
+	// or -1 on failure. Takes the Access itself: readers only wait for the
+	// swap, not for the copy.
+	long long Compact(void);
+	// Changes when Compact moves the records. A file offset kept across
+	// operations (a cursor's position) is only meaningful in the epoch it
+	// was taken in.
+	unsigned long long Epoch(void) const;
+
+	// Primary key allocator: returns the first of count consecutive keys.
+	// Keys are handed out above a high-water mark that is saved with the
+	// index, so they are unique and increasing. Thread safe. The mark on
+	// disk is kept ahead of the keys handed out, so a crash leaves a gap
+	// in the keys rather than handing one out twice.
+	long long ReserveKeys(long long count);
+
+	// Extent directory: for every RecName, the runs of adjacent records of
+	// that type. Moves offset forward to the next record that may be of
+	// type recName (offset itself if it is inside one of its extents);
+	// false when there are no more. Type filtered scans use it to skip
+	// the bytes of other record types. end, if given, receives the end of
+	// the extent offset is in.
+	bool NextOfType(const char* recName, std::streamoff& offset, std::streamoff* end = nullptr) const;
+	// Splits the extents of recName into [start, end) ranges of about
+	// chunkBytes that begin on a record, for a parallel scan. Records of one
+	// type have one size, recSize, so extents are split at multiples of it.
+	std::vector<std::pair<std::streamoff, std::streamoff>> ScanChunks(const char* recName,
+		int recSize, std::size_t chunkBytes);
+	// Threads used by a parallel scan; 0 (the default) uses one per core
+	void SetScanThreads(unsigned int threads);
+	unsigned int ScanThreads(void) const;
+
+	// Write-ahead log ("<file>.wal"). Inside a transaction every record write
+	// is logged (before and after image) and the data file is not flushed
+	// per write; Commit makes the whole batch durable with one fsync of the
+	// log and then checkpoints the data file in the background. Connect
+	// replays committed transactions and undoes an unfinished one.
+	bool Begin(void);
+	bool Commit(void);
+	bool Rollback(void);
+	bool InTransaction(void) const;
+	// Called by Record before writing size bytes at offset; also drops the
+	// cached pages of that range. Outside a transaction it first empties the
+	// log, so that a recovery never replays older images over the write.
+	void LogWrite(std::streamoff offset, const char* data, std::size_t size);
+	// Called by Record after a write: flushes now, or at Commit/next read
+	void Written(void);
+	// Cuts the data file back to size, dropping what a failed append left
+	void Truncate(std::streamoff size);
+
+	// Secondary indexes on a record type's field, identified like a recKey
+	// (offset/sz/typeInfo). Integer, char and bool fields can be indexed.
+	// Indexes live in memory and are built by one scan when declared.
+	bool AddFieldIndex(const char* recName, const recKey* k);
+	bool HasFieldIndex(const char* recName, const recKey* k) const;
+	// Called by the writes for the record of recSize bytes at offset; also
+	// widens the zone maps of its type
+	void IndexFields(const char* recName, std::streamoff offset, const char* body, int recSize);
+	void UnindexFields(const char* recName, std::streamoff offset);
+	// Offsets (ascending) of the records whose field satisfies "field comp key"
+	bool FieldCandidates(const char* recName, const recKey* k, long long key,
+		std::shared_ptr<const std::vector<std::streamoff>>& offsets);
+	static bool IsIndexable(const recKey* k);
+
+	// Zone maps: the min and max of a numeric or enum field over the records
+	// of one type that start in each block of ZoneBytes of the data file, so
+	// that scans skip the blocks a key rules out. A map is built by one scan
+	// the first time a scan can use it, then kept by the writes, refilled by
+	// RebuildIndex and saved with the index file.
+	// Writes only widen a zone (a delete or an overwritten value leaves it
+	// as is), so it may be wider than its records but never narrower.
+	struct ZoneMap
+	{
+		std::string recName;
+		std::size_t offset;
+		FieldKind kind;
+		std::vector<SeekPlan::Zone> zones;   // by block
+		std::vector<std::streamoff> ends;    // past the last record of the type starting in the block
+	};
+	static const std::size_t ZoneBytes = 64 * 1024;
+	// The map of each key of plan on recName, nullptr for keys that cannot
+	// use one. Valid while the Access is held.
+	void ZoneMaps(const char* recName, const SeekPlan& plan, std::vector<const ZoneMap*>& maps);
+	// False when no record of the type starting in the block of offset can
+	// match plan; end is then the offset past them
+	static bool BlockMayMatch(const SeekPlan& plan, const std::vector<const ZoneMap*>& maps,
+		std::streamoff offset, std::streamoff& end);
+
+	// Read access to the data file: returns a pointer to n bytes at offset,
+	// or nullptr if they are past the end of the file. When the file is
+	// memory mapped the pointer is into the mapping; otherwise the bytes are
+	// copied from the buffer pool into a buffer of the calling thread. Valid
+	// until the next View call on the same thread.
+	const char* View(std::streamoff offset, std::size_t n);
+	// Copies up to n bytes at offset to dest; returns the number copied
+	std::size_t Read(std::streamoff offset, char* dest, std::size_t n);
+	// Page cache used when the file is not memory mapped (the mapping is
+	// cached by the kernel). Cursors pin the page they are reading.
+	BufferPool& Pool(void);
+	// Decoded records handed out by Record::GetSharedRecord
+	ObjectCache& Objects(void);
+	// Batched reads for the buffer pool, and the background write queue
+	// (Record::InsertAsync...). Call IO().Drain() before taking an exclusive
+	// Access that waits for the queued writes.
+	AsyncIO& IO(void);
+	// Changes whenever the data file is written, so that copies of its
+	// bytes (a cursor's read-ahead) know when they are stale
+	unsigned long long Version(void) const;
+	void SetMemoryMapped(bool on);
+	bool IsMemoryMapped(void) const;
+
+private:
+	struct LogImage
+	{
+		std::streamoff offset;
+		std::vector<char> data;
+	};
+	struct FieldIndex
+	{
+		std::string recName;
+		std::size_t offset;
+		std::size_t sz;
+		const std::type_info* typeInfo;
+		std::multimap<long long, std::streamoff> ordered;      // range predicates
+		std::unordered_multimap<long long, std::streamoff> hashed;  // Comp::Equal
+		std::map<std::streamoff, long long> byRecord;         // record -> indexed value
+	};
+	struct Extent
+	{
+		std::streamoff start;
+		std::streamoff end;
+	};
+	struct TypeCount
+	{
+		long long live;
+		long long deleted;
+	};
+	void AddToExtent(const char* recName, std::streamoff offset, int recSize);
+	void CountType(const std::string& recName, long long live, long long deleted);
+
+	FieldIndex* FindFieldIndex(const char* recName, const recKey* k);
+	void BuildFieldIndex(FieldIndex& index);
+	static long long FieldValue(const FieldIndex& index, const char* body);
+	void AddFieldEntry(FieldIndex& index, std::streamoff offset, long long value);
+	void BuildZoneMap(ZoneMap& map);
+	static void AddToZone(ZoneMap& map, std::streamoff offset, int recSize, const char* body);
+	// Adds the record of recSize bytes at offset to the maps of its type
+	void ZoneRecord(const char* recName, std::streamoff offset, int recSize);
+
+	bool OpenLog(void);
+	bool Recover(void);
+	void UndoImages(const std::vector<LogImage>& images, std::streamoff size);
+	void AppendLog(int type, std::streamoff offset, const char* data, std::size_t size);
+	void Checkpoint(void);
+	void WaitCheckpoint(void);
+
+	bool CopyLive(const std::string& fileName);
+
+	bool LoadIndex(void);
+	void SaveIndex(void);
+	void MarkIndex(void);
+	std::streamoff DataFileSize(void);
+	int ReadFd(void);
+	std::size_t ReadFile(std::streamoff offset, char* dest, std::size_t n);
+	void ReadFileBatch(std::vector<AsyncIO::Request>& requests);
+	bool Remap(void);
+	void Unmap(void);
+	void Reclaim(void);
+	void FlushPending(void);
+
+	std::fstream* file = nullptr;
+	std::string dataFileName;
+	std::string indexFileName;
+	std::map<long long, std::streamoff> primaryIndex;
+	std::map<std::string, std::vector<Extent>> extents;   // sorted by start
+	unsigned int scanThreads = 0;
+	bool indexDirty = false;    // the index in memory differs from the index file
+	bool indexMarked = false;   // the index file is flagged dirty on disk
+	std::map<int, std::vector<std::streamoff>> freeSlots;   // size class -> tombstones
+	std::map<std::streamoff, std::string> slotTypes;        // slot -> type last deleted from it
+	std::map<std::string, TypeCount> typeCounts;
+	long long recordCount = 0;
+	std::streamoff dataEnd = 0;   // end of the last record
+	long long keyHighWater = 0;   // last primary key handed out or found on file
+	long long keyLease = 0;       // keys up to it may be handed out before the mark is synced again
+	long long markedLease = 0;    // key mark of the superblock on disk
+	std::mutex keyLock;           // also held by MarkIndex
+
+	std::vector<FieldIndex> fieldIndexes;
+	unsigned long long fieldGeneration = 0;   // bumped on every field index change
+	struct
+	{
+		const FieldIndex* index = nullptr;
+		Comp comp = Comp::Equal;
+		long long key = 0;
+		unsigned long long generation = 0;
+		std::shared_ptr<const std::vector<std::streamoff>> offsets;
+	} lastCandidates;     // so that Next does not redo the lookup of Seek
+	std::mutex candidatesLock;
+	std::vector<std::unique_ptr<ZoneMap>> zoneMaps;
+	std::mutex zoneLock;   // readers build maps under a shared Access
+	bool zonesChanged = false;   // a map was built since the index file was saved; under zoneLock
+
+	std::string logFileName;
+	std::atomic<int> logFd{ -1 };   // replaced by Checkpoint under logLock
+	std::streamoff logSize = 0;
+	std::streamoff logCommitted = 0;   // end of the last finished transaction
+	bool inTransaction = false;
+	std::atomic<bool> unflushed{ false };   // flushed by the next reader
+	std::atomic<unsigned long long> version{ 0 };
+	std::atomic<unsigned long long> epoch{ 0 };
+	std::mutex compactLock;
+	std::streamoff transactionStart = 0;   // data file size at Begin
+	std::vector<LogImage> undo;            // before images of this transaction
+	std::mutex logLock;                // also guards the two flags below
+	std::future<void> checkpoint;
+	bool checkpointing = false;        // the background checkpoint is running
+	bool checkpointWanted = false;     // a commit since its last round
+
+	std::shared_mutex accessLock;
+	std::recursive_mutex streamLock;
+
+	// Readers remap when the file grew; a replaced mapping may still be in
+	// use by another reader, so it is only unmapped under an exclusive Access
+	bool memoryMapped = true;
+	std::atomic<int> mapFd{ -1 };
+	std::atomic<char*> mapped{ nullptr };
+	std::atomic<std::size_t> mappedSize{ 0 };
+	std::vector<std::pair<char*, std::size_t>> retired;
+	std::mutex mapLock;
+	BufferPool pool;
+	ObjectCache objects;
+	AsyncIO io;   // last: its writer thread stops before the rest is destroyed
+};
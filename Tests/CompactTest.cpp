@@ -0,0 +1,195 @@
+// Database::Compact: the live records are kept, with their keys, counts and
+// field indexes, the space of deleted ones is reclaimed, readers on other
+// threads go on while it runs, and scans open across it neither skip nor
+// repeat records.
+//
+// Build it with the library sources and SYSCPPCPheaders on the include
+// path, e.g. g++ -std=c++17 -I. -I<SYSCPPCPheaders> Tests/CompactTest.cpp *.cpp -lpthread
+// It prints a line per check and exits with 1 at the first failure.
+#include "TestRecords.h"
+#include "Cursor.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+static const std::string fileName = "CompactTest.db";
+
+// Inserts Items with values first..last and a Tag between each of them
+static bool fill(int first, int last, std::vector<long long>& keys)
+{
+	for (int i = first; i <= last; i++)
+	{
+		Item item;
+		item.data.value = i;
+		CHECK(item.Insert());
+		keys.push_back(item.data.pk);
+		Tag tag;
+		tag.data.value = -i;
+		CHECK(tag.Insert());
+	}
+	return true;
+}
+static bool deleteItem(int value)
+{
+	Item item;
+	recKey k = ValueKey(value);
+	CHECK(item.Seek(&k, nullptr) == OpResult::True);
+	CHECK(item.Delete());
+	return true;
+}
+
+static bool keepsLiveRecords(void)
+{
+	RemoveDatabase(fileName);
+	Database db(fileName);
+	std::vector<long long> keys;
+	CHECK(fill(1, 100, keys));
+	for (int i = 1; i <= 100; i += 2)
+		CHECK(deleteItem(i));
+	recKey indexed = ValueKey(0);
+	CHECK(Item().CreateIndex(&indexed));
+
+	CHECK(db.Compact() == 50 * static_cast<long long>(sizeof(ItemData)));
+	CHECK(db.GetCount("Item") == 50);
+	CHECK(db.GetCount("Tag") == 100);
+	for (int i = 1; i <= 100; i++)
+	{
+		Record* rec = Record::GetRecordByIndex(keys[i - 1]);
+		CHECK((rec != nullptr) == (i % 2 == 0));
+		CHECK(rec == nullptr || static_cast<Item*>(rec)->data.value == i);
+		delete rec;
+	}
+	Item item;
+	recKey k = ValueKey(40);
+	CHECK(item.Seek(&k, nullptr) == OpResult::True && item.data.pk == keys[39]);
+
+	// Nothing left to reclaim
+	CHECK(db.Compact() == 0);
+	Item added;
+	CHECK(added.Insert());
+	CHECK(added.data.pk > keys.back());
+	return true;
+}
+
+// A compacted file is the one the next Connect opens
+static bool reopened(void)
+{
+	Database db(fileName);
+	CHECK(db.GetCount("Item") == 51);
+	CHECK(db.GetCount("Tag") == 100);
+	Item item;
+	recKey k = ValueKey(40);
+	CHECK(item.Seek(&k, nullptr) == OpResult::True);
+	return true;
+}
+
+// Seeks on another thread find their record all through the compaction,
+// while a third thread inserts
+static bool concurrentReaders(void)
+{
+	RemoveDatabase(fileName);
+	Database db(fileName);
+	std::vector<long long> keys;
+	CHECK(fill(1, 1000, keys));
+	for (int i = 1; i <= 1000; i += 2)
+		CHECK(deleteItem(i));
+
+	std::atomic<bool> done{ false };
+	std::atomic<int> missed{ 0 };
+	std::atomic<int> inserted{ 0 };
+	std::thread reader([&]()
+	{
+		while (!done)
+		{
+			Item item;
+			recKey k = ValueKey(500);
+			if (item.Seek(&k, nullptr) != OpResult::True)
+				missed++;
+		}
+	});
+	std::thread writer([&]()
+	{
+		for (int i = 0; i < 50; i++)
+		{
+			Item item;
+			item.data.value = 2000 + i;
+			if (item.Insert())
+				inserted++;
+		}
+	});
+	long long reclaimed = db.Compact();
+	writer.join();
+	done = true;
+	reader.join();
+	CHECK(reclaimed > 0);
+	CHECK(missed == 0);
+	CHECK(inserted == 50);
+	CHECK(db.GetCount("Item") == 550);
+	return true;
+}
+
+// A Seek/Next scan open across a Compact goes on after its last match
+static bool scanAcrossCompact(void)
+{
+	RemoveDatabase(fileName);
+	Database db(fileName);
+	std::vector<long long> keys;
+	CHECK(fill(4001, 4010, keys));
+	for (int i = 4002; i <= 4004; i++)
+		CHECK(deleteItem(i));
+
+	Item item;
+	recKey k = ValueKey(4000, Comp::Greater);
+	std::vector<int> values;
+	for (OpResult r = item.Seek(&k, nullptr); r == OpResult::True && item.data.value < 4007; r = item.Next(&k, nullptr))
+		values.push_back(item.data.value);
+	CHECK(item.data.value == 4007);
+	CHECK(db.Compact() > 0);
+	for (OpResult r = item.Next(&k, nullptr); r == OpResult::True; r = item.Next(&k, nullptr))
+		values.push_back(item.data.value);
+	CHECK((values == std::vector<int>{ 4001, 4005, 4006, 4008, 4009, 4010 }));
+
+	// A cursor that has not matched yet starts over: the file is shorter
+	// than its offset, and a record appended since is found
+	Item scanned;
+	recKey absent = ValueKey(4011);
+	Cursor cursor = scanned.Scan(&absent, nullptr);
+	CHECK(cursor.Next() == OpResult::False);
+	CHECK(deleteItem(4005));
+	CHECK(db.Compact() > 0);
+	Item added;
+	added.data.value = 4011;
+	CHECK(added.Insert());
+	CHECK(cursor.Next() == OpResult::True && scanned.data.pk == added.data.pk);
+
+	// The last match is gone: the scan can not tell where it was
+	CHECK(item.Seek(&k, nullptr) == OpResult::True && item.data.value == 4001);
+	CHECK(deleteItem(4001));
+	CHECK(db.Compact() > 0);
+	CHECK(item.Next(&k, nullptr) == OpResult::Null);
+	return true;
+}
+
+int main(void)
+{
+	RegisterTestRecords();
+	struct
+	{
+		const char* name;
+		bool (*run)(void);
+	} tests[] =
+	{
+		{ "keeps live records", keepsLiveRecords },
+		{ "reopened", reopened },
+		{ "concurrent readers", concurrentReaders },
+		{ "scan across compact", scanAcrossCompact },
+	};
+	for (const auto& test : tests)
+	{
+		if (!test.run())
+			return 1;
+		std::cout << test.name << " ok" << std::endl;
+	}
+	RemoveDatabase(fileName);
+	return 0;
+}
@@ -0,0 +1,146 @@
+// The counts kept in the index: GetCount, GetCounts and GetDeletedCounts
+// follow inserts, deletes and the reuse of free slots, are restored by a
+// Rollback, kept by Close, reset by Compact, and found again by the
+// rebuild after a crash.
+//
+// Build it with the library sources and SYSCPPCPheaders on the include
+// path, e.g. g++ -std=c++17 -I. -I<SYSCPPCPheaders> Tests/CountTest.cpp *.cpp -lpthread
+// It prints a line per check and exits with 1 at the first failure.
+#include "TestRecords.h"
+#include <map>
+
+static const std::string fileName = "CountTest.db";
+
+static bool deleteItem(int value)
+{
+	Item item;
+	recKey k = ValueKey(value);
+	CHECK(item.Seek(&k, nullptr) == OpResult::True);
+	CHECK(item.Delete());
+	return true;
+}
+// Slots in the file, and the live and deleted records by type
+static bool counts(Database& db, long slots, const std::map<std::string, long>& live,
+	const std::map<std::string, long>& deleted)
+{
+	std::map<std::string, long> found;
+	CHECK(db.GetCount() == slots);
+	db.GetCounts(found);
+	CHECK(found == live);
+	db.GetDeletedCounts(found);
+	CHECK(found == deleted);
+	for (const auto& it : live)
+		CHECK(db.GetCount(it.first) == it.second);
+	return true;
+}
+
+// Items with values 1..5 and three Tags, two Items deleted
+static bool insertsAndDeletes(void)
+{
+	RemoveDatabase(fileName);
+	Database db(fileName);
+	CHECK(counts(db, 0, {}, {}));
+	for (int i = 1; i <= 5; i++)
+	{
+		Item item;
+		item.data.value = i;
+		CHECK(item.Insert());
+	}
+	for (int i = 0; i < 3; i++)
+	{
+		Tag tag;
+		CHECK(tag.Insert());
+	}
+	CHECK(counts(db, 8, { { "Item", 5 }, { "Tag", 3 } }, {}));
+	CHECK(deleteItem(2));
+	CHECK(deleteItem(4));
+	CHECK(counts(db, 8, { { "Item", 3 }, { "Tag", 3 } }, { { "Item", 2 } }));
+	CHECK(db.GetCount("Note") == 0);
+
+	// A Tag in the slot of an Item
+	Tag tag;
+	CHECK(tag.Insert());
+	CHECK(counts(db, 8, { { "Item", 3 }, { "Tag", 4 } }, { { "Item", 1 } }));
+	return true;
+}
+
+static bool rollback(void)
+{
+	Database db(fileName);
+	CHECK(counts(db, 8, { { "Item", 3 }, { "Tag", 4 } }, { { "Item", 1 } }));
+	CHECK(db.BeginTransaction());
+	Item added;
+	added.data.value = 6;
+	CHECK(added.Insert());
+	Item appended;
+	appended.data.value = 7;
+	CHECK(appended.Insert());
+	CHECK(deleteItem(1));
+	CHECK(counts(db, 9, { { "Item", 4 }, { "Tag", 4 } }, { { "Item", 1 } }));
+	CHECK(db.Rollback());
+	CHECK(counts(db, 8, { { "Item", 3 }, { "Tag", 4 } }, { { "Item", 1 } }));
+	return true;
+}
+
+// Counts saved by Close are loaded by the next Connect
+static bool reopened(void)
+{
+	Database db(fileName);
+	CHECK(counts(db, 8, { { "Item", 3 }, { "Tag", 4 } }, { { "Item", 1 } }));
+	return true;
+}
+
+static bool compact(void)
+{
+	{
+		Database db(fileName);
+		CHECK(db.Compact() > 0);
+		CHECK(counts(db, 7, { { "Item", 3 }, { "Tag", 4 } }, {}));
+	}
+	Database db(fileName);
+	CHECK(counts(db, 7, { { "Item", 3 }, { "Tag", 4 } }, {}));
+	return true;
+}
+
+// The index of a database that was not closed is rebuilt from the file;
+// the type of a slot deleted since is then no longer known
+static bool rebuiltAfterCrash(void)
+{
+	CHECK(crash([]()
+	{
+		Database db(fileName);
+		Item item;
+		item.data.value = 8;
+		if (!item.Insert() || !deleteItem(3))
+			_exit(1);
+		_exit(0);
+	}));
+	Database db(fileName);
+	CHECK(counts(db, 8, { { "Item", 3 }, { "Tag", 4 } }, { { "", 1 } }));
+	return true;
+}
+
+int main(void)
+{
+	RegisterTestRecords();
+	struct
+	{
+		const char* name;
+		bool (*run)(void);
+	} tests[] =
+	{
+		{ "inserts and deletes", insertsAndDeletes },
+		{ "rollback", rollback },
+		{ "reopened", reopened },
+		{ "compact", compact },
+		{ "rebuilt after a crash", rebuiltAfterCrash },
+	};
+	for (const auto& test : tests)
+	{
+		if (!test.run())
+			return 1;
+		std::cout << test.name << " ok" << std::endl;
+	}
+	RemoveDatabase(fileName);
+	return 0;
+}
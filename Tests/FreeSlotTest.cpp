@@ -0,0 +1,216 @@
+// The free-space map: Insert reuses the slot of a deleted record of the
+// same size, whatever its type, instead of growing the file; a record of
+// another size is appended; and the free slots are kept by Close and found
+// again by the rebuild after a crash.
+//
+// Build it with the library sources and SYSCPPCPheaders on the include
+// path, e.g. g++ -std=c++17 -I. -I<SYSCPPCPheaders> Tests/FreeSlotTest.cpp *.cpp -lpthread
+// It prints a line per check and exits with 1 at the first failure.
+#include "TestRecords.h"
+#include <sys/stat.h>
+#include <vector>
+
+static const std::string fileName = "FreeSlotTest.db";
+
+#pragma pack(push, 1)
+struct NoteData
+{
+	int RecSize;
+	char RecName[REC_NAME_SIZE];
+	long long pk;        // 0
+	char text[64];       // 8
+};
+#pragma pack(pop)
+
+// A record of another size than Item
+class Note : public Record
+{
+public:
+	NoteData data;
+
+	Note()
+	{
+		memset(&data, 0, sizeof(data));
+		data.RecSize = sizeof(data);
+		strncpy(data.RecName, "Note", REC_NAME_SIZE - 1);
+		if (PrIdx && db != nullptr)
+		{
+			db->outFile.seekg(-static_cast<std::streamoff>(sizeof(int) + REC_NAME_SIZE + sizeof(long long)), std::ios::cur);
+			recordDBAddress = db->outFile.tellg();
+			db->outFile.read(reinterpret_cast<char*>(&data), sizeof(data));
+			PrIdx = 0;
+		}
+	}
+	void Dump() override { std::cout << data.pk << " " << data.text << std::endl; }
+	char* GetDataAddress() override { return reinterpret_cast<char*>(&data); }
+	int GetDataSize() override { return sizeof(data); }
+	const char* GetRecName() override { return data.RecName; }
+	void SetPrimaryKey(long long key) override { data.pk = key; }
+	long long GetPrimaryKey() override { return data.pk; }
+	unsigned int GetEnumValue(std::string) override { return 0; }
+};
+
+static long long fileSize(void)
+{
+	struct stat st;
+	return stat(fileName.c_str(), &st) == 0 ? st.st_size : -1;
+}
+// Items with values 1..count
+static bool fill(int count, std::vector<long long>& keys)
+{
+	for (int i = 1; i <= count; i++)
+	{
+		Item item;
+		item.data.value = i;
+		CHECK(item.Insert());
+		keys.push_back(item.data.pk);
+	}
+	return true;
+}
+static bool deleteItem(long long key)
+{
+	Record* rec = Record::GetRecordByIndex(key);
+	CHECK(rec != nullptr);
+	bool deleted = rec->Delete();
+	delete rec;
+	return deleted;
+}
+// Inserts an Item with value; it must not grow the file
+static bool insertInPlace(int value, long long& key)
+{
+	long long size = fileSize();
+	Item item;
+	item.data.value = value;
+	CHECK(item.Insert());
+	CHECK(fileSize() == size);
+	key = item.data.pk;
+	return true;
+}
+static bool hasValue(long long key, int value)
+{
+	Record* rec = Record::GetRecordByIndex(key);
+	bool found = rec != nullptr && static_cast<Item*>(rec)->data.value == value;
+	delete rec;
+	return found;
+}
+
+static bool reusesSlot(void)
+{
+	RemoveDatabase(fileName);
+	Database db(fileName);
+	std::vector<long long> keys;
+	CHECK(fill(10, keys));
+	long long size = fileSize();
+	CHECK(deleteItem(keys[3]));
+	CHECK(deleteItem(keys[6]));
+	CHECK(fileSize() == size);
+	CHECK(db.GetCount("Item") == 8);
+
+	long long added;
+	CHECK(insertInPlace(100, added));
+	CHECK(added > keys.back());
+	CHECK(hasValue(added, 100));
+	CHECK(Record::GetRecordByIndex(keys[3]) == nullptr);
+	Item item;
+	recKey k = ValueKey(100);
+	CHECK(item.Seek(&k, nullptr) == OpResult::True && item.data.pk == added);
+
+	// A Tag has the size of an Item and takes the other slot
+	Tag tag;
+	tag.data.value = 200;
+	CHECK(tag.Insert());
+	CHECK(fileSize() == size);
+	CHECK(db.GetCount("Item") == 9);
+	CHECK(db.GetCount("Tag") == 1);
+
+	// No slot left: the next one appends
+	Item appended;
+	CHECK(appended.Insert());
+	CHECK(fileSize() == size + static_cast<long long>(sizeof(ItemData)));
+	for (int i = 1; i <= 10; i++)
+		CHECK(i == 4 || i == 7 || hasValue(keys[i - 1], i));
+	return true;
+}
+
+// A record of another size never lands in a slot
+static bool otherSizeAppends(void)
+{
+	RemoveDatabase(fileName);
+	Database db(fileName);
+	std::vector<long long> keys;
+	CHECK(fill(3, keys));
+	CHECK(deleteItem(keys[1]));
+	long long size = fileSize();
+	Note note;
+	strncpy(note.data.text, "appended", sizeof(note.data.text) - 1);
+	CHECK(note.Insert());
+	CHECK(fileSize() == size + static_cast<long long>(sizeof(NoteData)));
+	CHECK(hasValue(keys[0], 1) && hasValue(keys[2], 3));
+
+	// The Item slot is still free
+	long long added;
+	CHECK(insertInPlace(4, added));
+	return true;
+}
+
+// Free slots are saved by Close, and found by the rebuild after a crash
+static bool keptAcrossReopen(void)
+{
+	RemoveDatabase(fileName);
+	std::vector<long long> keys;
+	{
+		Database db(fileName);
+		CHECK(fill(6, keys));
+		CHECK(deleteItem(keys[0]));
+		CHECK(deleteItem(keys[4]));
+	}
+	{
+		Database db(fileName);
+		CHECK(db.GetCount("Item") == 4);
+		long long added;
+		CHECK(insertInPlace(10, added));
+		CHECK(hasValue(added, 10));
+	}
+	CHECK(crash([]()
+	{
+		Database db(fileName);
+		Item item;
+		recKey k = ValueKey(2);
+		if (item.Seek(&k, nullptr) != OpResult::True || !item.Delete())
+			_exit(1);
+		_exit(0);
+	}));
+	Database db(fileName);
+	CHECK(db.GetCount("Item") == 4);
+	long long first;
+	long long second;
+	CHECK(insertInPlace(11, first));
+	CHECK(insertInPlace(12, second));
+	CHECK(hasValue(first, 11) && hasValue(second, 12));
+	CHECK(db.GetCount("Item") == 6);
+	return true;
+}
+
+int main(void)
+{
+	RegisterTestRecords();
+	Record::getRecordFactory()["Note"] = []() -> Record* { return new Note(); };
+	struct
+	{
+		const char* name;
+		bool (*run)(void);
+	} tests[] =
+	{
+		{ "reuses slot", reusesSlot },
+		{ "other size appends", otherSizeAppends },
+		{ "kept across reopen", keptAcrossReopen },
+	};
+	for (const auto& test : tests)
+	{
+		if (!test.run())
+			return 1;
+		std::cout << test.name << " ok" << std::endl;
+	}
+	RemoveDatabase(fileName);
+	return 0;
+}
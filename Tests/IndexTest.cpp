@@ -0,0 +1,185 @@
+// Persistence of the primary key index (<file>.idx): an index saved by Close
+// is loaded at the next Connect, and one left behind by a crash is rebuilt
+// from the data file instead of being trusted. Crashes are simulated by a
+// child process that writes and then calls _exit without closing.
+//
+// Build it with the library sources and SYSCPPCPheaders on the include
+// path, e.g. g++ -std=c++17 -I. -I<SYSCPPCPheaders> Tests/IndexTest.cpp *.cpp
+// It prints a line per check and exits with 1 at the first failure.
+#include "TestRecords.h"
+#include <set>
+#include <unistd.h>
+#include <vector>
+
+static const std::string fileName = "IndexTest.db";
+
+// Every live record of the file, by a full scan
+static void scanKeys(std::vector<long long>& keys)
+{
+	keys.clear();
+	Item item;
+	for (OpResult r = item.Seek(nullptr); r == OpResult::True; r = item.Next(nullptr))
+		keys.push_back(item.data.pk);
+}
+static bool unique(const std::vector<long long>& keys)
+{
+	return std::set<long long>(keys.begin(), keys.end()).size() == keys.size();
+}
+
+static bool savedIndex(void)
+{
+	RemoveDatabase(fileName);
+	std::vector<long long> keys;
+	{
+		Database db(fileName);
+		for (int i = 1; i <= 5; i++)
+		{
+			Item item;
+			item.data.value = i;
+			CHECK(item.Insert());
+			keys.push_back(item.data.pk);
+		}
+		Item deleted;
+		recKey k = ValueKey(3);
+		CHECK(deleted.Seek(&k, nullptr) == OpResult::True);
+		CHECK(deleted.Delete());
+	}
+	Database db(fileName);
+	CHECK(db.GetCount() == 5);
+	CHECK(db.GetCount("Item") == 4);
+	Record* rec = Record::GetRecordByIndex(keys[3]);
+	CHECK(rec != nullptr && static_cast<Item*>(rec)->data.value == 4);
+	delete rec;
+	CHECK(Record::GetRecordByIndex(keys[2]) == nullptr);
+	Item item;
+	CHECK(item.Insert());
+	CHECK(item.data.pk > keys.back());
+	return true;
+}
+
+// Deleting a record and reusing its slot leaves the file the same size;
+// the index of the last Close must not be trusted after a crash
+static bool crashAfterSlotReuse(void)
+{
+	RemoveDatabase(fileName);
+	{
+		Database db(fileName);
+		for (int i = 1; i <= 5; i++)
+		{
+			Item item;
+			item.data.value = i;
+			CHECK(item.Insert());
+		}
+	}
+	bool exited = crash([]()
+	{
+		Database db(fileName);
+		Item first;
+		recKey k = ValueKey(1);
+		if (first.Seek(&k, nullptr) != OpResult::True || !first.Delete())
+			_exit(1);
+		Item item;
+		item.data.value = 6;
+		_exit(item.Insert() ? 0 : 1);
+	});
+	CHECK(exited);
+
+	Database db(fileName);
+	CHECK(db.GetCount() == 5);
+	CHECK(db.GetCount("Item") == 5);
+	Item six;
+	recKey k6 = ValueKey(6);
+	CHECK(six.Seek(&k6, nullptr) == OpResult::True);
+	long long reused = six.data.pk;
+	recKey k1 = ValueKey(1);
+	CHECK(Item().Seek(&k1, nullptr) == OpResult::False);
+
+	Item item;
+	item.data.value = 7;
+	CHECK(item.Insert());
+	CHECK(item.data.pk > reused);
+	std::vector<long long> keys;
+	scanKeys(keys);
+	CHECK(keys.size() == 6);
+	CHECK(unique(keys));
+	return true;
+}
+
+// A key handed out and deleted before a crash is not handed out again,
+// even though no record on file holds it any more
+static bool crashAfterDeletingLastKey(void)
+{
+	RemoveDatabase(fileName);
+	{
+		Database db(fileName);
+		Item item;
+		item.data.value = 1;
+		CHECK(item.Insert());
+	}
+	long long highest = 0;
+	int fds[2];
+	CHECK(::pipe(fds) == 0);
+	bool exited = crash([&fds]()
+	{
+		Database db(fileName);
+		Item item;
+		item.data.value = 2;
+		if (!item.Insert() || !item.Delete())
+			_exit(1);
+		long long key = item.data.pk;
+		_exit(write(fds[1], &key, sizeof(key)) == sizeof(key) ? 0 : 1);
+	});
+	CHECK(exited);
+	CHECK(read(fds[0], &highest, sizeof(highest)) == sizeof(highest));
+	close(fds[0]);
+	close(fds[1]);
+
+	Database db(fileName);
+	CHECK(db.GetCount("Item") == 1);
+	Item item;
+	item.data.value = 3;
+	CHECK(item.Insert());
+	CHECK(item.data.pk > highest);
+	return true;
+}
+
+// After the crash is repaired, a clean Close saves an index that the next
+// Connect loads with the right counts
+static bool closeAfterCrash(void)
+{
+	{
+		Database db(fileName);
+		CHECK(db.GetCount("Item") == 2);
+	}
+	Database db(fileName);
+	CHECK(db.GetCount("Item") == 2);
+	std::vector<long long> keys;
+	scanKeys(keys);
+	CHECK(keys.size() == 2);
+	CHECK(unique(keys));
+	return true;
+}
+
+int main(void)
+{
+	RegisterTestRecords();
+	struct
+	{
+		const char* name;
+		bool (*run)(void);
+	} tests[] =
+	{
+		{ "saved index", savedIndex },
+		{ "crash after slot reuse", crashAfterSlotReuse },
+		{ "crash after deleting the last key", crashAfterDeletingLastKey },
+		{ "close after crash", closeAfterCrash },
+	};
+	for (const auto& test : tests)
+	{
+		if (!test.run())
+			return 1;
+		std::cout << test.name << " ok" << std::endl;
+	}
+	RemoveDatabase(fileName);
+	return 0;
+}
@@ -0,0 +1,190 @@
+// The write-ahead log (<file>.wal): after a crash, Connect redoes the
+// committed transactions and undoes an unfinished one; Rollback restores
+// the records a transaction changed; and a checkpoint that runs while the
+// next transaction writes keeps what that transaction needs to be undone.
+//
+// Build it with the library sources and SYSCPPCPheaders on the include
+// path, e.g. g++ -std=c++17 -I. -I<SYSCPPCPheaders> Tests/LogTest.cpp *.cpp -lpthread
+// It prints a line per check and exits with 1 at the first failure.
+#include "TestRecords.h"
+#include <chrono>
+#include <sys/stat.h>
+#include <thread>
+
+static const std::string fileName = "LogTest.db";
+
+// Value of the Item with key, or -1 if there is none
+static int valueOf(long long key)
+{
+	Record* rec = Record::GetRecordByIndex(key);
+	int value = rec != nullptr ? static_cast<Item*>(rec)->data.value : -1;
+	delete rec;
+	return value;
+}
+static bool setValue(long long key, int value)
+{
+	Record* rec = Record::GetRecordByIndex(key);
+	CHECK(rec != nullptr);
+	static_cast<Item*>(rec)->data.value = value;
+	bool updated = rec->Update();
+	delete rec;
+	return updated;
+}
+static long long logSize(void)
+{
+	struct stat st;
+	return stat((fileName + ".wal").c_str(), &st) == 0 ? st.st_size : -1;
+}
+
+// Two records outside a transaction, with values 1 and 2
+static bool start(long long keys[2])
+{
+	RemoveDatabase(fileName);
+	Database db(fileName);
+	for (int i = 0; i < 2; i++)
+	{
+		Item item;
+		item.data.value = i + 1;
+		CHECK(item.Insert());
+		keys[i] = item.data.pk;
+	}
+	return true;
+}
+
+static bool rollback(void)
+{
+	long long keys[2];
+	CHECK(start(keys));
+	Database db(fileName);
+	CHECK(db.BeginTransaction());
+	CHECK(setValue(keys[0], 10));
+	Item added;
+	CHECK(added.Insert());
+	CHECK(db.Rollback());
+	CHECK(valueOf(keys[0]) == 1);
+	CHECK(valueOf(added.data.pk) == -1);
+	CHECK(db.GetCount("Item") == 2);
+	return true;
+}
+
+// A committed transaction is in the file after a crash, even if the data
+// file was never synced
+static bool crashAfterCommit(void)
+{
+	long long keys[2];
+	CHECK(start(keys));
+	CHECK(crash([&keys]()
+	{
+		Database db(fileName);
+		if (!db.BeginTransaction() || !setValue(keys[0], 10) || !setValue(keys[1], 20) || !db.Commit())
+			_exit(1);
+		_exit(0);
+	}));
+	Database db(fileName);
+	CHECK(valueOf(keys[0]) == 10);
+	CHECK(valueOf(keys[1]) == 20);
+	return true;
+}
+
+// An unfinished transaction is undone, appended records included
+static bool crashInTransaction(void)
+{
+	long long keys[2];
+	CHECK(start(keys));
+	CHECK(crash([&keys]()
+	{
+		Database db(fileName);
+		if (!db.BeginTransaction() || !setValue(keys[0], 10))
+			_exit(1);
+		Item added;
+		added.data.value = 3;
+		if (!added.Insert() || !setValue(keys[1], 20))
+			_exit(1);
+		_exit(0);
+	}));
+	Database db(fileName);
+	CHECK(valueOf(keys[0]) == 1);
+	CHECK(valueOf(keys[1]) == 2);
+	CHECK(db.GetCount("Item") == 2);
+	recKey k = ValueKey(3);
+	CHECK(Item().Seek(&k, nullptr) == OpResult::False);
+	return true;
+}
+
+// The checkpoint of a commit runs in the background while the next
+// transaction writes; the log it leaves still undoes that transaction
+static bool checkpointDuringTransaction(void)
+{
+	long long keys[2];
+	CHECK(start(keys));
+	CHECK(crash([&keys]()
+	{
+		Database db(fileName);
+		for (int i = 0; i < 20; i++)
+		{
+			if (!db.BeginTransaction() || !setValue(keys[0], 100 + i) || !db.Commit())
+				_exit(1);
+		}
+		if (!db.BeginTransaction() || !setValue(keys[1], 20))
+			_exit(1);
+		// Unless it already has, the checkpoint drops the committed
+		// transactions from the log while this one goes on
+		long long size = logSize();
+		for (int wait = 0; wait < 100 && logSize() >= size; wait++)
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		if (!setValue(keys[0], 30))
+			_exit(1);
+		_exit(0);
+	}));
+	CHECK(logSize() > 0);
+	Database db(fileName);
+	CHECK(valueOf(keys[0]) == 119);
+	CHECK(valueOf(keys[1]) == 2);
+	return true;
+}
+
+// A clean Close leaves an empty log
+static bool closeEmptiesLog(void)
+{
+	long long keys[2];
+	CHECK(start(keys));
+	{
+		Database db(fileName);
+		CHECK(db.BeginTransaction());
+		CHECK(setValue(keys[0], 10));
+		CHECK(db.Commit());
+		CHECK(db.BeginTransaction());
+		CHECK(setValue(keys[1], 20));
+		CHECK(db.Commit());
+	}
+	CHECK(logSize() == 0);
+	Database db(fileName);
+	CHECK(valueOf(keys[0]) == 10);
+	CHECK(valueOf(keys[1]) == 20);
+	return true;
+}
+
+int main(void)
+{
+	RegisterTestRecords();
+	struct
+	{
+		const char* name;
+		bool (*run)(void);
+	} tests[] =
+	{
+		{ "rollback", rollback },
+		{ "crash after commit", crashAfterCommit },
+		{ "crash in a transaction", crashInTransaction },
+		{ "checkpoint during a transaction", checkpointDuringTransaction },
+		{ "close empties the log", closeEmptiesLog },
+	};
+	for (const auto& test : tests)
+	{
+		if (!test.run())
+			return 1;
+		std::cout << test.name << " ok" << std::endl;
+	}
+	RemoveDatabase(fileName);
+	return 0;
+}
@@ -0,0 +1,401 @@
+// Equivalence check of the compiled seek keys against Record::processSeek,
+// and of the vector kernels against plain comparisons:
+// - FilterField at every SimdLevel the CPU has, on edge values of each kind
+// - SeekPlan::Match against processSeek for random AND/OR chains of keys
+// - MatchBatch and MatchColumns against Match at every level
+// - SeekPlan::MayMatch never rules out a block holding a match
+//
+// Build it with the library sources and SYSCPPCPheaders on the include
+// path, e.g. g++ -std=c++17 -I. -I<SYSCPPCPheaders> Tests/SeekPlanTest.cpp *.cpp
+// It prints a line per check and exits with 1 at the first mismatch.
+#include "Database.h"
+#include "Record.h"
+#include "SeekPlan.h"
+#include "FilterKernel.h"
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#pragma pack(push, 1)
+// The body of a test record, as recKey offsets see it
+struct TestBody
+{
+	long long pk;              // 0
+	int i;                     // 8
+	char c;                    // 12
+	bool b;                    // 13
+	short s;                   // 14
+	unsigned int u;            // 16
+	unsigned long long ull;    // 20
+	long long ll;              // 28
+	unsigned char uc;          // 36
+};
+#pragma pack(pop)
+
+// Exposes processSeek, evaluated over a list of keys the way Seek does
+class TestRecord : public Record
+{
+public:
+	void Dump() override {}
+	char* GetDataAddress() override { return nullptr; }
+	int GetDataSize() override { return 0; }
+	const char* GetRecName() override { return "TestRecord"; }
+	void SetPrimaryKey(long long) override {}
+	long long GetPrimaryKey() override { return 0; }
+	unsigned int GetEnumValue(std::string) override { return 0; }
+
+	OpResult Seek(const std::vector<recKey*>& keys, const char* body)
+	{
+		LastOpResult = OpResult::Null;
+		LastAndOr = AndOr::Null;
+		for (recKey* k : keys)
+			LastOpResult = processSeek(k, body);
+		return LastOpResult;
+	}
+};
+
+static std::mt19937_64 rng(20260101);
+
+static const SimdLevel levels[] = { SimdLevel::Scalar, SimdLevel::Avx2, SimdLevel::Avx512 };
+static const Comp comps[] = { Comp::Equal, Comp::NotEqual, Comp::Greater, Comp::Smaller, Comp::GreaterEq, Comp::SmallerEq };
+
+static bool fail(const std::string& what)
+{
+	std::cerr << "MISMATCH: " << what << std::endl;
+	return false;
+}
+
+// Values at the edges of each kind: limits, sign changes, and the points
+// the unsigned kernels bias around (2^31, 2^63)
+template <typename T>
+static std::vector<T> edges(void)
+{
+	std::vector<T> v = { std::numeric_limits<T>::min(), static_cast<T>(std::numeric_limits<T>::min() + 1),
+		static_cast<T>(std::numeric_limits<T>::max() - 1), std::numeric_limits<T>::max(),
+		0, 1, static_cast<T>(-1), static_cast<T>(-2), 2 };
+	const T half = static_cast<T>(std::numeric_limits<T>::max() / 2 + 1);   // 2^(n-1) for unsigned T
+	v.push_back(half);
+	v.push_back(static_cast<T>(half - 1));
+	v.push_back(static_cast<T>(half + 1));
+	return v;
+}
+template <typename T>
+static T pick(void)
+{
+	static const std::vector<T> v = edges<T>();
+	if (rng() % 2)
+		return v[rng() % v.size()];
+	return static_cast<T>(static_cast<long long>(rng() % 7) - 3);
+}
+
+//==============================
+// FilterField
+
+template <typename T>
+static bool compare(T value, Comp comp, T key)
+{
+	switch (comp)
+	{
+	case Comp::Equal: return value == key;
+	case Comp::NotEqual: return value != key;
+	case Comp::Greater: return value > key;
+	case Comp::Smaller: return value < key;
+	case Comp::GreaterEq: return value >= key;
+	case Comp::SmallerEq: return value <= key;
+	}
+	return false;
+}
+template <typename T>
+static bool checkKernel(FieldKind kind, int runs)
+{
+	for (int run = 0; run < runs; run++)
+	{
+		const std::size_t stride = sizeof(T) + rng() % 24;
+		const std::size_t offset = rng() % (stride - sizeof(T) + 1);
+		const std::size_t count = rng() % 300;
+		std::vector<char> block(count * stride + 3);   // padding, as the kernels may need
+		for (char& c : block)
+			c = static_cast<char>(rng());
+		for (std::size_t i = 0; i < count; i++)
+		{
+			T value = pick<T>();
+			memcpy(&block[i * stride + offset], &value, sizeof(T));
+		}
+		const T key = pick<T>();
+		const Comp comp = comps[rng() % 6];
+
+		std::vector<unsigned long long> want((count + 63) / 64, 0);
+		for (std::size_t i = 0; i < count; i++)
+		{
+			T value;
+			memcpy(&value, &block[i * stride + offset], sizeof(T));
+			if (compare(value, comp, key))
+				want[i / 64] |= 1ULL << (i % 64);
+		}
+		for (SimdLevel level : levels)
+		{
+			SetFilterLevel(level);
+			if (FilterLevel() != level)
+				continue;
+			std::vector<unsigned long long> got((count + 63) / 64, 0);
+			FilterField(block.data() + offset, stride, count, kind, comp, static_cast<long long>(key), got.data());
+			if (got != want)
+			{
+				std::ostringstream what;
+				what << "FilterField kind " << static_cast<int>(kind) << " comp " << static_cast<int>(comp)
+					<< " level " << static_cast<int>(level) << " count " << count << " stride " << stride;
+				return fail(what.str());
+			}
+		}
+	}
+	return true;
+}
+static bool checkKernels(void)
+{
+	const int runs = 2000;
+	bool ok = checkKernel<signed char>(FieldKind::Int8, runs) &&
+		checkKernel<unsigned char>(FieldKind::UInt8, runs) &&
+		checkKernel<short>(FieldKind::Int16, runs) &&
+		checkKernel<unsigned short>(FieldKind::UInt16, runs) &&
+		checkKernel<int>(FieldKind::Int32, runs) &&
+		checkKernel<unsigned int>(FieldKind::UInt32, runs) &&
+		checkKernel<long long>(FieldKind::Int64, runs) &&
+		checkKernel<unsigned long long>(FieldKind::UInt64, runs);
+	SetFilterLevel(SimdLevel::Avx512);   // back to the best the CPU has
+	return ok;
+}
+
+//==============================
+// SeekPlan against processSeek
+
+static TestBody randomBody(void)
+{
+	static const char chars[] = { 'a', 'b', 'm', 'z', '\0', '\x7f', '\x80', '\xe9', '\xff' };
+	TestBody b;
+	b.pk = static_cast<long long>(rng() % 1000);
+	b.i = pick<int>();
+	b.c = chars[rng() % sizeof(chars)];
+	b.b = rng() % 2 != 0;
+	b.s = pick<short>();
+	b.u = pick<unsigned int>();
+	b.ull = pick<unsigned long long>();
+	b.ll = pick<long long>();
+	b.uc = static_cast<unsigned char>(chars[rng() % sizeof(chars)]);
+	return b;
+}
+// A key on a random field; its constant is an edge of the field's type,
+// sometimes out of its range or not a number
+static recKey* randomKey(AndOr andOr)
+{
+	static const char* chars[] = { "a", "m", "z", "\x80", "\xe9", "" };
+	static const char* bools[] = { "true", "False", "1", "0", "maybe" };
+	Comp comp = comps[rng() % 6];
+	auto number = [](void) -> std::string
+	{
+		switch (rng() % 8)
+		{
+		case 0: return std::to_string(pick<unsigned int>());
+		case 1: return std::to_string(pick<unsigned long long>());
+		case 2: return std::to_string(pick<short>());
+		case 3: return "x1";
+		default: return std::to_string(pick<long long>() % 5 == 0 ? pick<long long>() : pick<int>());
+		}
+	};
+	switch (rng() % 9)
+	{
+	case 0: return new recKey{ number(), comp, andOr, typeid(int), 8, sizeof(int) };
+	case 1: return new recKey{ chars[rng() % 6], comp, andOr, typeid(char), 12, sizeof(char) };
+	case 2: return new recKey{ bools[rng() % 5], comp, andOr, typeid(bool), 13, sizeof(bool) };
+	case 3: return new recKey{ number(), comp, andOr, typeid(short), 14, sizeof(short) };
+	case 4: return new recKey{ number(), comp, andOr, typeid(unsigned int), 16, sizeof(unsigned int) };
+	case 5: return new recKey{ number(), comp, andOr, typeid(unsigned long long), 20, sizeof(unsigned long long) };
+	case 6: return new recKey{ number(), comp, andOr, typeid(long long), 28, sizeof(long long) };
+	case 7: return new recKey{ chars[rng() % 6], comp, andOr, typeid(unsigned char), 36, sizeof(unsigned char) };
+	default: return new recKey{ number(), comp, andOr, typeid(unsigned short), 14, sizeof(unsigned short) };
+	}
+}
+// 1 to 4 keys; owned holds them
+static std::vector<recKey*> randomKeys(std::vector<std::unique_ptr<recKey>>& owned)
+{
+	std::vector<recKey*> keys;
+	const std::size_t n = 1 + rng() % 4;
+	for (std::size_t j = 0; j < n; j++)
+	{
+		owned.emplace_back(randomKey(j + 1 == n ? AndOr::Null : (rng() % 2 ? AndOr::And : AndOr::Or)));
+		keys.push_back(owned.back().get());
+	}
+	return keys;
+}
+static std::string describe(const std::vector<recKey*>& keys)
+{
+	std::ostringstream what;
+	for (recKey* k : keys)
+		what << "[" << k->typeInfo.name() << "@" << k->offset << " " << static_cast<int>(k->comp) << " '" << k->value << "' "
+			<< static_cast<int>(k->andOr) << "] ";
+	return what.str();
+}
+
+// The result, or Null with the kind of exception thrown
+template <typename F>
+static OpResult run(F f, int& thrown)
+{
+	thrown = 0;
+	try {
+		return f();
+	}
+	catch (const std::invalid_argument&) {
+		thrown = 1;
+	}
+	catch (const std::out_of_range&) {
+		thrown = 2;
+	}
+	return OpResult::Null;
+}
+
+static bool checkMatch(int plans, int records)
+{
+	TestRecord record;
+	for (int p = 0; p < plans; p++)
+	{
+		std::vector<std::unique_ptr<recKey>> owned;
+		std::vector<recKey*> keys = randomKeys(owned);
+		SeekPlan plan;
+		plan.Compile(keys, [&record](std::string name) { return record.GetEnumValue(name); });
+		for (int r = 0; r < records; r++)
+		{
+			TestBody body = randomBody();
+			int planThrew, seekThrew;
+			OpResult got = run([&]() { return plan.Match(reinterpret_cast<const char*>(&body)); }, planThrew);
+			// processSeek lowercases bool constants in place; the plan holds its own copy
+			OpResult want = run([&]() { return record.Seek(keys, reinterpret_cast<const char*>(&body)); }, seekThrew);
+			if (got != want || planThrew != seekThrew)
+				return fail("Match " + describe(keys));
+		}
+	}
+	return true;
+}
+
+//==============================
+// Blocks and columns against Match, and zones
+
+static bool checkBlocks(int plans, std::size_t& batched, std::size_t& pruned)
+{
+	TestRecord record;
+	const std::size_t stride = sizeof(TestBody) + sizeof(int) + REC_NAME_SIZE;
+	for (int p = 0; p < plans; p++)
+	{
+		std::vector<std::unique_ptr<recKey>> owned;
+		std::vector<recKey*> keys = randomKeys(owned);
+		SeekPlan plan;
+		plan.Compile(keys, [&record](std::string name) { return record.GetEnumValue(name); });
+
+		// Records as they lie in the file: size and name, then the body
+		const std::size_t count = rng() % (2 * SeekPlan::BlockRows);
+		std::vector<char> block(count * stride + 3);
+		std::vector<TestBody> bodies(count);
+		for (std::size_t i = 0; i < count; i++)
+		{
+			bodies[i] = randomBody();
+			memcpy(&block[i * stride + sizeof(int) + REC_NAME_SIZE], &bodies[i], sizeof(TestBody));
+		}
+		std::vector<unsigned long long> want((count + 63) / 64, 0);
+		bool throws = false;
+		for (std::size_t i = 0; i < count && !throws; i++)
+		{
+			int thrown;
+			OpResult r = run([&]() { return plan.Match(reinterpret_cast<const char*>(&bodies[i])); }, thrown);
+			throws = thrown != 0;
+			if (r == OpResult::True)
+				want[i / 64] |= 1ULL << (i % 64);
+		}
+		if (throws)
+			continue;   // MatchBatch throws like Match; nothing to compare
+		batched += plan.Batchable();
+
+		// Columns: the field of each key, padded as the kernels may read past it
+		std::vector<std::vector<char>> columns(keys.size());
+		std::vector<const char*> fields;
+		std::vector<std::size_t> strides;
+		for (std::size_t j = 0; j < keys.size(); j++)
+		{
+			columns[j].resize(count * keys[j]->sz + 3);
+			for (std::size_t i = 0; i < count; i++)
+				memcpy(&columns[j][i * keys[j]->sz], reinterpret_cast<const char*>(&bodies[i]) + keys[j]->offset, keys[j]->sz);
+			fields.push_back(columns[j].data());
+			strides.push_back(keys[j]->sz);
+		}
+		for (SimdLevel level : levels)
+		{
+			SetFilterLevel(level);
+			if (FilterLevel() != level)
+				continue;
+			std::vector<unsigned long long> got;
+			plan.MatchBatch(block.data() + sizeof(int) + REC_NAME_SIZE, stride, count, got);
+			got.resize(want.size());
+			if (got != want)
+				return fail("MatchBatch level " + std::to_string(static_cast<int>(level)) + " " + describe(keys));
+			got.clear();
+			plan.MatchColumns(fields, strides, count, got);
+			got.resize(want.size());
+			if (got != want)
+				return fail("MatchColumns level " + std::to_string(static_cast<int>(level)) + " " + describe(keys));
+		}
+		SetFilterLevel(SimdLevel::Avx512);
+
+		// Zones of the block: ruling it out is only right when nothing matches
+		const std::vector<SeekPlan::Term>& terms = plan.Terms();
+		std::vector<SeekPlan::Zone> zones(terms.size());
+		for (std::size_t j = 0; j < terms.size(); j++)
+		{
+			zones[j].kind = terms[j].kind;
+			for (std::size_t i = 0; i < count && terms[j].vectorized; i++)
+				zones[j].Add(reinterpret_cast<const char*>(&bodies[i]) + terms[j].offset);
+		}
+		bool may = plan.MayMatch([&](const SeekPlan::Term& t) -> const SeekPlan::Zone*
+		{
+			return t.vectorized ? &zones[&t - terms.data()] : nullptr;
+		});
+		bool any = false;
+		for (unsigned long long w : want)
+			any = any || w != 0;
+		if (!may && any)
+			return fail("MayMatch ruled out a block with a match " + describe(keys));
+		pruned += !may && count > 0;
+	}
+	return true;
+}
+
+int main(void)
+{
+	// processSeek reports unsupported comparisons on std::cout
+	std::ostringstream quiet;
+	std::streambuf* out = std::cout.rdbuf();
+
+	std::cout << "kernels at levels up to " << static_cast<int>(FilterLevel()) << std::endl;
+	if (!checkKernels())
+		return 1;
+	std::cout << "FilterField ok" << std::endl;
+
+	std::cout.rdbuf(quiet.rdbuf());
+	bool ok = checkMatch(20000, 20);
+	std::cout.rdbuf(out);
+	if (!ok)
+		return 1;
+	std::cout << "Match ok" << std::endl;
+
+	std::size_t batched = 0, pruned = 0;
+	std::cout.rdbuf(quiet.rdbuf());
+	ok = checkBlocks(5000, batched, pruned);
+	std::cout.rdbuf(out);
+	if (!ok)
+		return 1;
+	std::cout << "MatchBatch, MatchColumns and MayMatch ok (" << batched << " batchable plans, "
+		<< pruned << " blocks ruled out)" << std::endl;
+	return 0;
+}
@@ -0,0 +1,103 @@
+// Record types and helpers shared by the behavior tests. The records are
+// laid out and load themselves the way generated records do: a derived
+// constructor reads the record Record::GetRecordName left the stream at
+// when PrIdx is set.
+#pragma once
+#include "Database.h"
+#include "Record.h"
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define CHECK(condition) \
+	do { \
+		if (!(condition)) \
+		{ \
+			std::cerr << "FAILED: " #condition " (" << __FILE__ << ":" << __LINE__ << ")" << std::endl; \
+			return false; \
+		} \
+	} while (0)
+
+#pragma pack(push, 1)
+struct ItemData
+{
+	int RecSize;
+	char RecName[REC_NAME_SIZE];
+	long long pk;        // 0
+	int value;           // 8
+	char name[16];       // 12
+};
+#pragma pack(pop)
+
+class Item : public Record
+{
+public:
+	ItemData data;
+
+	explicit Item(const char* recName = "Item")
+	{
+		memset(&data, 0, sizeof(data));
+		data.RecSize = sizeof(data);
+		strncpy(data.RecName, recName, REC_NAME_SIZE - 1);
+		if (PrIdx && db != nullptr)
+		{
+			// The stream is just past the header of the record
+			db->outFile.seekg(-static_cast<std::streamoff>(sizeof(int) + REC_NAME_SIZE + sizeof(long long)), std::ios::cur);
+			recordDBAddress = db->outFile.tellg();
+			db->outFile.read(reinterpret_cast<char*>(&data), sizeof(data));
+			PrIdx = 0;
+		}
+	}
+	void Dump() override { std::cout << data.pk << " " << data.value << " " << data.name << std::endl; }
+	char* GetDataAddress() override { return reinterpret_cast<char*>(&data); }
+	int GetDataSize() override { return sizeof(data); }
+	const char* GetRecName() override { return data.RecName; }
+	void SetPrimaryKey(long long key) override { data.pk = key; }
+	long long GetPrimaryKey() override { return data.pk; }
+	unsigned int GetEnumValue(std::string) override { return 0; }
+};
+// A second type of the same size, to mix types in one file
+class Tag : public Item
+{
+public:
+	Tag() : Item("Tag") {}
+};
+
+// A key on Item::value
+inline recKey ValueKey(int value, Comp comp = Comp::Equal, AndOr andOr = AndOr::Null)
+{
+	return recKey{ std::to_string(value), comp, andOr, typeid(int), 8, sizeof(int) };
+}
+
+inline void RegisterTestRecords(void)
+{
+	Record::getRecordFactory()["Item"] = []() -> Record* { return new Item(); };
+	Record::getRecordFactory()["Tag"] = []() -> Record* { return new Tag(); };
+}
+
+// Removes a database and the files kept beside it
+inline void RemoveDatabase(const std::string& fileName)
+{
+	for (const char* suffix : { "", ".idx", ".wal", ".wal.tail", ".compact" })
+		remove((fileName + suffix).c_str());
+}
+
+// Runs body in a child process, as a crash: body ends with _exit while
+// its database is still open, so that it is never closed. True if it
+// exited with 0.
+template <typename F>
+bool crash(F body)
+{
+	std::cout.flush();
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		body();
+		_exit(1);
+	}
+	int status;
+	return pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}